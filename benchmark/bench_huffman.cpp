@@ -1,8 +1,321 @@
 #include <benchmark/benchmark.h>
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
 #include <filesystem>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "code.h"
+#include "compression_stats.h"
 #include "concurrent_huffman.h"
+#include "crc32c.h"
+#include "decoding_table.h"
+#include "format.h"
+#include "thread_pool.h"
 
-static void BM_Compression(benchmark::State &state)
+namespace {
+// The kinds of text that the corpus benchmarks are run on.
+enum class Corpus
+{
+    uniform,
+    zipf,
+    single_symbol,
+    english,
+    binary
+};
+
+const std::vector<std::pair<Corpus, std::string>> corpora = {{Corpus::uniform, "uniform"}, {Corpus::zipf, "zipf"},
+    {Corpus::single_symbol, "single_symbol"}, {Corpus::english, "english"}, {Corpus::binary, "binary"}};
+
+// The corpora are generated in pieces of this size and repeated up to the size being benchmarked. A Huffman code only
+// depends on how often each character occurs, so repeating a piece this large changes neither the code nor the speed.
+constexpr uint64_t corpus_piece_size = 16 << 20;
+
+/**
+ * Generates text whose characters follow a Zipf distribution, the k-th most common character occurring about 1 / k^s
+ * times as often as the most common one.
+ *
+ * @param size the number of characters to generate.
+ * @param num_symbols the number of distinct characters, require that it is at most 256.
+ * @param s the exponent of the distribution.
+ * @param random the generator that the characters are drawn from.
+ * @return the generated text.
+ */
+std::string generateZipf(uint64_t size, uint32_t num_symbols, double s, std::mt19937_64 &random)
+{
+    std::vector<double> weights(num_symbols);
+    for (uint32_t i = 0; i < num_symbols; ++i)
+        weights[i] = 1.0 / std::pow(i + 1, s);
+    std::discrete_distribution<uint32_t> distribution(weights.begin(), weights.end());
+    std::string text(size, '\0');
+    for (char &character : text)
+        character = static_cast<char>(distribution(random));
+    return text;
+}
+
+/**
+ * Generates text that looks like English prose: common words chosen with Zipf frequencies, separated by spaces, with
+ * punctuation and line breaks.
+ *
+ * @param size the number of characters to generate.
+ * @param random the generator that the words are drawn from.
+ * @return the generated text.
+ */
+std::string generateEnglish(uint64_t size, std::mt19937_64 &random)
+{
+    static const std::vector<std::string> words = {"the", "of", "and", "to", "a", "in", "is", "that", "it", "was", "for", "on", "are",
+        "as", "with", "his", "they", "at", "be", "this", "from", "have", "or", "by", "one", "had", "not", "but", "what", "all",
+        "were", "when", "we", "there", "can", "an", "your", "which", "their", "said", "if", "do", "will", "each", "about", "how",
+        "up", "out", "them", "then", "she", "many", "some", "so", "these", "would", "other", "into", "has", "more", "her", "two",
+        "like", "him", "see", "time", "could", "no", "make", "than", "first", "been", "its", "who", "now", "people", "my", "made",
+        "over", "did", "down", "only", "way", "find", "use", "may", "water", "long", "little", "very", "after", "words", "called",
+        "just", "where", "most", "know", "Huffman", "compression", "thread", "September", "quickly", "zebra", "jazz"};
+    std::vector<double> weights(words.size());
+    for (size_t i = 0; i < words.size(); ++i)
+        weights[i] = 1.0 / static_cast<double>(i + 1);
+    std::discrete_distribution<size_t> word_distribution(weights.begin(), weights.end());
+    std::uniform_int_distribution<uint32_t> punctuation_distribution(0, 99);
+
+    std::string text;
+    text.reserve(size + 32);
+    bool sentence_start = true;
+    while (text.size() < size)
+    {
+        std::string word = words[word_distribution(random)];
+        if (sentence_start)
+            word[0] = static_cast<char>(std::toupper(static_cast<unsigned char>(word[0])));
+        text += word;
+        const uint32_t punctuation = punctuation_distribution(random);
+        sentence_start = punctuation < 8;
+        if (punctuation < 6)
+            text += ". ";
+        else if (punctuation < 7)
+            text += "?\n";
+        else if (punctuation < 8)
+            text += ".\n\n";
+        else if (punctuation < 14)
+            text += ", ";
+        else
+            text += ' ';
+    }
+    text.resize(size);
+    return text;
+}
+
+/**
+ * Generates data that looks like the contents of a binary file: runs of zero bytes, small little-endian integers,
+ * pointer-like words, and stretches of random bytes.
+ *
+ * @param size the number of bytes to generate.
+ * @param random the generator that the data is drawn from.
+ * @return the generated data.
+ */
+std::string generateBinary(uint64_t size, std::mt19937_64 &random)
+{
+    std::uniform_int_distribution<uint32_t> kind_distribution(0, 9);
+    std::geometric_distribution<uint32_t> small_distribution(0.05);
+    std::string data;
+    data.reserve(size + 8);
+    while (data.size() < size)
+    {
+        const uint32_t kind = kind_distribution(random);
+        uint64_t word = 0;
+        if (kind < 3)
+            word = 0;
+        else if (kind < 7)
+            word = small_distribution(random);
+        else if (kind < 9)
+            word = 0x00007f0000000000ULL | (random() & 0xffffffff8ULL);
+        else
+            word = random();
+        for (uint32_t i = 0; i < 8; ++i)
+            data += static_cast<char>((word >> (8 * i)) & 0xff);
+    }
+    data.resize(size);
+    return data;
+}
+
+/**
+ * @param corpus the kind of text to generate.
+ * @param size the number of characters to generate.
+ * @return text of the given kind. The same arguments always give the same text.
+ */
+std::string generateCorpus(Corpus corpus, uint64_t size)
+{
+    std::mt19937_64 random(42);
+    const uint64_t piece_size = std::min(size, corpus_piece_size);
+    std::string piece;
+    switch (corpus)
+    {
+    case Corpus::uniform:
+        // An exponent of zero gives every character the same weight.
+        piece = generateZipf(piece_size, 256, 0, random);
+        break;
+    case Corpus::zipf:
+        piece = generateZipf(piece_size, 256, 1.2, random);
+        break;
+    case Corpus::single_symbol:
+        piece.assign(piece_size, 'a');
+        break;
+    case Corpus::english:
+        piece = generateEnglish(piece_size, random);
+        break;
+    case Corpus::binary:
+        piece = generateBinary(piece_size, random);
+        break;
+    }
+    std::string text;
+    text.reserve(size);
+    while (text.size() < size)
+        text.append(piece, 0, std::min<uint64_t>(piece.size(), size - text.size()));
+    return text;
+}
+
+/**
+ * Returns the text of a corpus, generating it only when it differs from the one asked for last. Benchmarks of the same
+ * corpus and size run one after another, and keeping a single corpus in memory leaves room for the largest sizes.
+ *
+ * @param corpus the kind of text.
+ * @param size the number of characters in the text.
+ * @return the text of the corpus.
+ */
+const std::string &corpusText(Corpus corpus, uint64_t size)
+{
+    static Corpus cached_corpus;
+    static std::string cached_text;
+    static bool cached = false;
+    if (!cached || cached_corpus != corpus || cached_text.size() != size)
+    {
+        cached_text.clear();
+        cached_text.shrink_to_fit();
+        cached_text = generateCorpus(corpus, size);
+        cached_corpus = corpus;
+        cached = true;
+    }
+    return cached_text;
+}
+
+/**
+ * Reports the number of megabytes processed per second, which is shown as MB=.../s.
+ *
+ * @param state the state of a benchmark.
+ * @param bytes the number of bytes that each iteration processes.
+ */
+void setThroughput(benchmark::State &state, uint64_t bytes)
+{
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * bytes));
+    state.counters["MB"] = benchmark::Counter(static_cast<double>(bytes) / 1e6, benchmark::Counter::kIsIterationInvariantRate);
+}
+
+/**
+ * Adds the sizes that the corpus benchmarks run at, from 1 KB to 256 MB. The sizes of 1 GB and 4 GB take several times
+ * their size in memory and are only added when the environment variable CONCURRENT_HUFFMAN_BENCH_LARGE is set.
+ *
+ * @param benchmark the benchmark that the sizes are added to.
+ */
+void corpusSizes(benchmark::internal::Benchmark *benchmark)
+{
+    std::vector<int64_t> sizes = {1 << 10, 64 << 10, 1 << 20, 16 << 20, 256 << 20};
+    if (std::getenv("CONCURRENT_HUFFMAN_BENCH_LARGE") != nullptr)
+    {
+        sizes.push_back(int64_t(1) << 30);
+        sizes.push_back(int64_t(4) << 30);
+    }
+    // The work runs on the threads of the pool, so the speed is measured against the time on the clock.
+    benchmark->UseRealTime()->ArgNames({"bytes"});
+    for (const int64_t size : sizes)
+        benchmark->Args({size});
+}
+
+void BM_Compress(benchmark::State &state, Corpus corpus)
+{
+    const std::string &text = corpusText(corpus, state.range(0));
+    Concurrent::ThreadPool &pool = ConcurrentHuffman::defaultPool();
+    std::string compressed;
+    for (auto _ : state)
+        ConcurrentHuffman::compress(text, compressed, pool);
+    setThroughput(state, text.size());
+    state.counters["ratio"] = static_cast<double>(compressed.size()) / static_cast<double>(std::max<size_t>(text.size(), 1));
+}
+
+void BM_Decompress(benchmark::State &state, Corpus corpus)
+{
+    const std::string &text = corpusText(corpus, state.range(0));
+    Concurrent::ThreadPool &pool = ConcurrentHuffman::defaultPool();
+    std::string compressed;
+    ConcurrentHuffman::compress(text, compressed, pool);
+    std::string decompressed;
+    for (auto _ : state)
+        ConcurrentHuffman::decompress(compressed, decompressed, pool);
+    setThroughput(state, text.size());
+}
+
+/**
+ * Compresses and decompresses a corpus and reports the speed of every stage of the encoder and decoder, as measured by
+ * the statistics of each call.
+ */
+void BM_Stages(benchmark::State &state, Corpus corpus)
+{
+    const std::string &text = corpusText(corpus, state.range(0));
+    Concurrent::ThreadPool &pool = ConcurrentHuffman::defaultPool();
+    std::string compressed;
+    std::string decompressed;
+    CompressionStats stats;
+    std::chrono::nanoseconds counting{0}, code_construction{0}, indexing{0}, encoding{0}, decoding{0};
+    for (auto _ : state)
+    {
+        ConcurrentHuffman::compress(text, compressed, pool, CompressionOptions(), &stats);
+        counting += stats.counting.wall_time;
+        code_construction += stats.code_construction.wall_time;
+        indexing += stats.indexing.wall_time;
+        encoding += stats.encoding.wall_time;
+        ConcurrentHuffman::decompress(compressed, decompressed, pool, &stats);
+        decoding += stats.decoding.wall_time;
+    }
+
+    // Report every stage that runs over the text as a speed, and the construction of the code, which only depends on
+    // the number of distinct characters, as a time per call.
+    const double bytes = static_cast<double>(text.size()) * static_cast<double>(state.iterations());
+    const auto speed = [bytes](std::chrono::nanoseconds time) {
+        return time.count() == 0 ? 0.0 : bytes / 1e6 / std::chrono::duration<double>(time).count();
+    };
+    state.counters["counting MB/s"] = speed(counting);
+    state.counters["indexing MB/s"] = speed(indexing);
+    state.counters["encoding MB/s"] = speed(encoding);
+    state.counters["decoding MB/s"] = speed(decoding);
+    state.counters["code us"] = std::chrono::duration<double, std::micro>(code_construction).count() / state.iterations();
+}
+
+/**
+ * Builds the canonical code and the decoding table of a corpus, which the decoder does for the header of every file and
+ * for every code table of a frame.
+ */
+void BM_DecodingTable(benchmark::State &state, Corpus corpus)
+{
+    std::string compressed_text;
+    ConcurrentHuffman::compress(corpusText(corpus, 1 << 20), compressed_text, ConcurrentHuffman::defaultPool());
+    std::istringstream compressed(compressed_text);
+    const HeaderData header_data = Format::readHeader(compressed);
+    for (auto _ : state)
+    {
+        DecodingTable table(CanonicalCode::fromLengths(header_data.code_lengths));
+        benchmark::DoNotOptimize(table);
+    }
+}
+
+void BM_Crc32c(benchmark::State &state)
+{
+    const std::string &text = corpusText(Corpus::english, state.range(0));
+    for (auto _ : state)
+        benchmark::DoNotOptimize(Crc32c::compute(reinterpret_cast<const unsigned char *>(text.data()), text.size()));
+    setThroughput(state, text.size());
+}
+
+void BM_Compression(benchmark::State &state)
 {
     std::string uncompressed_file = "bench_uncompressed.txt";
     std::string compressed_file = "compressed.txt";
@@ -14,7 +327,7 @@ static void BM_Compression(benchmark::State &state)
     std::filesystem::remove(compressed_file);
 }
 
-static void BM_Decompression(benchmark::State &state)
+void BM_Decompression(benchmark::State &state)
 {
     std::string compressed_file = "bench_compressed.txt";
     std::string uncompressed_file = "uncompressed.txt";
@@ -26,6 +339,83 @@ static void BM_Decompression(benchmark::State &state)
     std::filesystem::remove(uncompressed_file);
 }
 
+void BM_ThreadPoolWakeUp(benchmark::State &state)
+{
+    Concurrent::ThreadPool pool(1);
+    const auto idle_time = std::chrono::milliseconds(state.range(0));
+    for (auto _ : state)
+    {
+        // Leave the pool idle so that its worker goes to sleep, then time how long a task takes to start running.
+        std::this_thread::sleep_for(idle_time);
+        const auto submitted = std::chrono::steady_clock::now();
+        const auto started = pool.submitTask([] { return std::chrono::steady_clock::now(); }).get();
+        state.SetIterationTime(std::chrono::duration<double>(started - submitted).count());
+    }
+}
+
+/**
+ * Submits a task and waits for its result, the round trip that every task of the encoder and decoder pays.
+ */
+void BM_ThreadPoolRoundTrip(benchmark::State &state)
+{
+    Concurrent::ThreadPool pool(state.range(0));
+    for (auto _ : state)
+        benchmark::DoNotOptimize(pool.submitTask([] { return 1; }).get());
+}
+
+/**
+ * Submits a batch of empty tasks before waiting for any of them, which measures the cost of submitting and running a
+ * task when the workers are kept busy.
+ */
+void BM_ThreadPoolSubmit(benchmark::State &state)
+{
+    Concurrent::ThreadPool pool(state.range(0));
+    constexpr uint32_t batch_size = 1024;
+    std::vector<std::future<void>> futures;
+    futures.reserve(batch_size);
+    for (auto _ : state)
+    {
+        for (uint32_t i = 0; i < batch_size; ++i)
+            futures.push_back(pool.submitTask([] {}));
+        for (auto &future : futures)
+            future.wait();
+        futures.clear();
+    }
+    state.SetItemsProcessed(state.iterations() * batch_size);
+}
+
+/**
+ * Registers the benchmarks that run on every corpus, named after the corpus.
+ */
+void registerCorpusBenchmarks()
+{
+    for (const auto &[corpus, name] : corpora)
+    {
+        benchmark::RegisterBenchmark(("BM_Compress/" + name).c_str(), BM_Compress, corpus)->Apply(corpusSizes);
+        benchmark::RegisterBenchmark(("BM_Decompress/" + name).c_str(), BM_Decompress, corpus)->Apply(corpusSizes);
+        benchmark::RegisterBenchmark(("BM_Stages/" + name).c_str(), BM_Stages, corpus)
+            ->Unit(benchmark::kMillisecond)
+            ->UseRealTime()
+            ->ArgNames({"bytes"})
+            ->Args({16 << 20});
+        benchmark::RegisterBenchmark(("BM_DecodingTable/" + name).c_str(), BM_DecodingTable, corpus)->Unit(benchmark::kMicrosecond);
+    }
+}
+} // namespace
+
+BENCHMARK(BM_Crc32c)->ArgNames({"bytes"})->Args({64 << 10})->Args({16 << 20});
 BENCHMARK(BM_Compression)->Unit(benchmark::kMillisecond)->ArgNames({"Number of threads"})->Args({1})->Args({5})->Args({10});
 BENCHMARK(BM_Decompression)->Unit(benchmark::kMillisecond)->ArgNames({"Number of threads"})->Args({1})->Args({5})->Args({10});
-BENCHMARK_MAIN();
+BENCHMARK(BM_ThreadPoolWakeUp)->UseManualTime()->Unit(benchmark::kMicrosecond)->ArgNames({"Idle milliseconds"})->Args({0})->Args({10});
+BENCHMARK(BM_ThreadPoolRoundTrip)->UseRealTime()->Unit(benchmark::kMicrosecond)->ArgNames({"Number of threads"})->Args({1})->Args({4});
+BENCHMARK(BM_ThreadPoolSubmit)->UseRealTime()->Unit(benchmark::kMicrosecond)->ArgNames({"Number of threads"})->Args({1})->Args({4});
+
+int main(int argc, char **argv)
+{
+    registerCorpusBenchmarks();
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv))
+        return 1;
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+}
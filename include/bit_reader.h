@@ -0,0 +1,96 @@
+#ifndef CONCURRENT_HUFFMAN_BIT_READER_H
+#define CONCURRENT_HUFFMAN_BIT_READER_H
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Reads bits from a packed byte buffer, the first bit read is the most significant bit of the first byte.
+ * Bits are kept left aligned in a 64-bit buffer that is refilled a word at a time. Reading past the end of the
+ * data yields zeros.
+ */
+class BitReader
+{
+public:
+    /**
+     * A constructor for the bit reader.
+     *
+     * @param data_ the packed bits that will be read.
+     * @param size_ the number of bytes in data_.
+     * @param bit_position the position of the first bit that will be read, require that it is within the data.
+     */
+    BitReader(const unsigned char *data_, size_t size_, uint64_t bit_position = 0)
+        : data(data_)
+        , size(size_)
+        , byte_position(bit_position / 8)
+    {
+        refill();
+        consume(bit_position % 8);
+    }
+
+    /**
+     * Tops up the bit buffer so that it holds at least 56 bits, or every remaining bit of the data.
+     */
+    void refill()
+    {
+        if (byte_position + 8 <= size)
+        {
+            buffer |= loadWord(data + byte_position) >> bit_count;
+            const uint32_t num_bytes = (63 - bit_count) / 8;
+            byte_position += num_bytes;
+            bit_count += num_bytes * 8;
+            return;
+        }
+        while (bit_count <= 56 && byte_position < size)
+        {
+            buffer |= static_cast<uint64_t>(data[byte_position]) << (56 - bit_count);
+            ++byte_position;
+            bit_count += 8;
+        }
+    }
+
+    /**
+     * Returns the next bits without consuming them.
+     *
+     * @param length the number of bits to peek, require that length is between 1 and 56.
+     * @return the next length bits, the first bit is the most significant.
+     */
+    uint64_t peek(uint32_t length) const
+    {
+        return buffer >> (64 - length);
+    }
+
+    /**
+     * Discards bits from the buffer.
+     *
+     * @param length the number of bits to discard, require that length does not exceed the number of buffered bits.
+     */
+    void consume(uint32_t length)
+    {
+        buffer <<= length;
+        bit_count -= length;
+    }
+
+    /**
+     * @return the position of the next bit that will be read.
+     */
+    uint64_t position() const
+    {
+        return static_cast<uint64_t>(byte_position) * 8 - bit_count;
+    }
+
+private:
+    const unsigned char *data;
+    size_t size;
+    size_t byte_position;
+    uint64_t buffer = 0;
+    uint32_t bit_count = 0;
+
+    static uint64_t loadWord(const unsigned char *bytes)
+    {
+        uint64_t word = 0;
+        for (uint32_t i = 0; i < 8; ++i)
+            word |= static_cast<uint64_t>(bytes[i]) << (56 - 8 * i);
+        return word;
+    }
+};
+#endif // CONCURRENT_HUFFMAN_BIT_READER_H
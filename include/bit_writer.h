@@ -0,0 +1,84 @@
+#ifndef CONCURRENT_HUFFMAN_BIT_WRITER_H
+#define CONCURRENT_HUFFMAN_BIT_WRITER_H
+#include <cstdint>
+
+/**
+ * Packs codes into memory. Bits are collected in a 64-bit accumulator and whole words are stored to the output, the
+ * first bit written is the most significant bit of the first byte. Several writers can fill neighbouring ranges of
+ * bits at the same time: a writer stores the bytes that its range starts in or covers, but a final byte that its range
+ * only partly fills is handed back by flush so that it can be merged with the bits of the range after it.
+ */
+class BitWriter
+{
+public:
+    /**
+     * A constructor for the bit writer.
+     *
+     * @param output_ the location that the packed bits will be written to.
+     * @param bit_offset the position in output of the first bit that will be written. The bits before it in the same byte
+     *                   are stored as zeros, require that they are merged back in by the caller.
+     */
+    explicit BitWriter(unsigned char *output_, uint64_t bit_offset = 0)
+        : output(output_ + bit_offset / 8)
+        , free_bits(64 - bit_offset % 8)
+    {}
+
+    /**
+     * Writes the low length bits of bits, most significant bit first.
+     *
+     * @param bits the bits to write, require that all bits above the low length bits are zero.
+     * @param length the number of bits to write, require that length is between 1 and 64.
+     */
+    void write(uint64_t bits, uint32_t length)
+    {
+        bit_count += length;
+        if (length < free_bits)
+        {
+            free_bits -= length;
+            accumulator |= bits << free_bits;
+            return;
+        }
+        // Fill the accumulator with the leading bits of the code and keep the rest for the next word.
+        const uint32_t overflow = length - free_bits;
+        accumulator |= bits >> overflow;
+        flushWord();
+        free_bits = 64 - overflow;
+        accumulator = overflow != 0 ? bits << free_bits : 0;
+    }
+
+    /**
+     * Stores the whole bytes remaining in the accumulator, require that no bits are written afterwards.
+     *
+     * @return the final byte, padded with zeros, if the bits written end part way through it and zero otherwise. The
+     *         final byte is not stored in that case, since it is shared with the bits that are written after it.
+     */
+    unsigned char flush()
+    {
+        const uint32_t used_bits = 64 - free_bits;
+        for (uint32_t i = 0; i < used_bits / 8; ++i)
+            output[i] = static_cast<unsigned char>(accumulator >> (56 - 8 * i));
+        return used_bits % 8 != 0 ? static_cast<unsigned char>(accumulator >> (56 - used_bits / 8 * 8)) : 0;
+    }
+
+    /**
+     * @return the total number of bits that have been written.
+     */
+    uint64_t bitCount() const
+    {
+        return bit_count;
+    }
+
+private:
+    unsigned char *output;
+    uint64_t accumulator = 0;
+    uint32_t free_bits;
+    uint64_t bit_count = 0;
+
+    void flushWord()
+    {
+        for (uint32_t i = 0; i < 8; ++i)
+            output[i] = static_cast<unsigned char>(accumulator >> (56 - 8 * i));
+        output += 8;
+    }
+};
+#endif // CONCURRENT_HUFFMAN_BIT_WRITER_H
@@ -0,0 +1,44 @@
+#ifndef CONCURRENT_HUFFMAN_CODE_H
+#define CONCURRENT_HUFFMAN_CODE_H
+#include <array>
+#include <cstdint>
+
+/**
+ * A Huffman code. The code is stored in the low length bits of bits, the first bit of the code is the most significant.
+ */
+struct Code
+{
+    uint64_t bits = 0;
+    uint8_t length = 0;
+};
+
+// Maps every byte value to its code. Symbols that do not occur in the text have a code of length zero.
+using CodeTable = std::array<Code, 256>;
+
+// Maps every byte value to the length of its code. Symbols that do not occur in the text have a length of zero.
+using CodeLengths = std::array<uint8_t, 256>;
+
+struct CanonicalCode
+{
+    // The longest code that can be stored in a Code.
+    static constexpr uint32_t max_code_length = 64;
+
+    /**
+     * Assigns canonical Huffman codes. Codes are handed out in order of increasing length, codes of the same length are
+     * handed out in order of increasing symbol value. The codes can therefore be rebuilt from their lengths alone.
+     *
+     * @param code_lengths the length of the code of each symbol, require that the lengths are valid.
+     * @return a table that maps symbols to their canonical code.
+     */
+    static CodeTable fromLengths(const CodeLengths &code_lengths);
+
+    /**
+     * Checks whether a prefix free code exists with the given lengths. A single symbol with a code of length one is
+     * allowed, all other codes must be complete.
+     *
+     * @param code_lengths the length of the code of each symbol.
+     * @return true if the lengths describe a code that can be decoded and false otherwise.
+     */
+    static bool isValid(const CodeLengths &code_lengths);
+};
+#endif // CONCURRENT_HUFFMAN_CODE_H
@@ -0,0 +1,33 @@
+#ifndef CONCURRENT_HUFFMAN_COMPRESSION_OPTIONS_H
+#define CONCURRENT_HUFFMAN_COMPRESSION_OPTIONS_H
+#include <cstdint>
+
+/**
+ * Settings that control how a file is compressed. Files compressed with any settings can be decompressed without
+ * knowing the settings that were used.
+ */
+struct CompressionOptions
+{
+    // The longest code that may be assigned to a symbol, must be between 8 and 64. When the Huffman code of the text
+    // is deeper than this, the optimal code whose lengths do not exceed the limit is used instead.
+    uint8_t max_code_length = 64;
+    // The most memory, in bytes, that compression may use to buffer the file, zero removes the limit. With a limit, the
+    // file is read, encoded, and written one frame at a time so that files larger than memory can be compressed. The
+    // frames also bound the memory used to decompress the file. Frames are made of whole 64 KiB blocks, so the limit must
+    // leave room for at least one: (8 + max_code_length) * 16 KiB, which is 1152 KiB with the longest codes, plus 2 KiB
+    // for every stream of a block when blocks_per_table is set.
+    uint64_t memory_limit = 0;
+    // Whether to store a CRC-32C checksum of every block. Decompression then checks every block that it decodes, and
+    // verifyFile can check the whole file without writing anything.
+    bool checksums = false;
+    // The number of blocks in each group of blocks that may get a code table of its own, zero uses a single table for
+    // the whole file. Each group is given the table built from its own character frequencies, unless the table that the
+    // group before it used is almost as good. This makes files whose contents change from one section to the next
+    // smaller, at the cost of storing the extra tables.
+    uint32_t blocks_per_table = 0;
+    // Whether to split every block into four streams that are decoded side by side. The encoded text is the same, but
+    // the position of every stream is stored, which lets a single thread decode the streams at once and overlap their
+    // table lookups.
+    bool interleaved_streams = false;
+};
+#endif // CONCURRENT_HUFFMAN_COMPRESSION_OPTIONS_H
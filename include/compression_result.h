@@ -0,0 +1,15 @@
+#ifndef CONCURRENT_HUFFMAN_COMPRESSION_RESULT_H
+#define CONCURRENT_HUFFMAN_COMPRESSION_RESULT_H
+#include <cstdint>
+#include <exception>
+
+// The outcome of compressing one of the files of a batch.
+struct CompressionResult
+{
+    // The number of bytes in the original file and in the compressed file, both zero if the file was not compressed.
+    uint64_t uncompressed_size = 0;
+    uint64_t compressed_size = 0;
+    // The exception that was thrown while compressing the file, or a null pointer if the file was compressed.
+    std::exception_ptr error;
+};
+#endif // CONCURRENT_HUFFMAN_COMPRESSION_RESULT_H
@@ -0,0 +1,63 @@
+#ifndef CONCURRENT_HUFFMAN_COMPRESSION_STATS_H
+#define CONCURRENT_HUFFMAN_COMPRESSION_STATS_H
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+
+// The time that one stage of a compression or decompression took.
+struct StageTime
+{
+    // The time that passed on the calling thread while the stage ran.
+    std::chrono::nanoseconds wall_time{0};
+    // The processor time that every thread of the process used while the stage ran, including threads of other calls.
+    std::chrono::nanoseconds cpu_time{0};
+};
+
+/**
+ * Statistics about a single compression or decompression, used to find the stage that a slow call spends its time in.
+ * Stages that a call does not have are left at zero, and a stage that runs once for every frame is summed over the
+ * frames. The processor time is read from std::clock, which measures the whole process rather than the call. It also
+ * counts the tasks of other calls that run at the same time, such as calls made from other threads on a shared pool
+ * like ConcurrentHuffman::defaultPool(), any other work that the process does, and workers that spin for a moment while
+ * they wait for tasks. The processor times and the utilization are only those of the call when nothing else runs.
+ */
+struct CompressionStats
+{
+    // Opening the input and reading its headers, or waiting for frames of the input to be read.
+    StageTime reading;
+    // Counting the characters of the text.
+    StageTime counting;
+    // Finding the code lengths of the file.
+    StageTime code_construction;
+    // Building the block index of every frame: the encoded size, checksum, and code table of each block.
+    StageTime indexing;
+    // Encoding the blocks.
+    StageTime encoding;
+    // Decoding the blocks and comparing them with their checksums.
+    StageTime decoding;
+    // Creating the output, or waiting for frames of the output to be written.
+    StageTime writing;
+    // The whole call, including the work between the stages above.
+    StageTime total;
+    // The number of bytes that the call read and wrote.
+    uint64_t bytes_in = 0;
+    uint64_t bytes_out = 0;
+    // The number of frames and blocks in the compressed text.
+    uint64_t num_frames = 0;
+    uint64_t num_blocks = 0;
+    // The number of threads that worked on the call, the workers of the pool and the thread that made the call.
+    uint32_t num_threads = 0;
+
+    /**
+     * @return the share of the time of the call that its threads were busy, the processor time of the call over its wall
+     *         time for every thread. A value near one means that the threads were kept busy throughout.
+     */
+    double utilization() const
+    {
+        if (total.wall_time.count() == 0 || num_threads == 0)
+            return 0;
+        const double busy_time = static_cast<double>(total.cpu_time.count());
+        return std::min(busy_time / (static_cast<double>(total.wall_time.count()) * num_threads), 1.0);
+    }
+};
+#endif // CONCURRENT_HUFFMAN_COMPRESSION_STATS_H
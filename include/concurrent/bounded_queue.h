@@ -0,0 +1,82 @@
+#ifndef CONCURRENT_HUFFMAN_BOUNDED_QUEUE_H
+#define CONCURRENT_HUFFMAN_BOUNDED_QUEUE_H
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <queue>
+
+namespace Concurrent {
+/**
+ * A queue that holds a limited number of items, used to hand work from one stage of a pipeline to the next. A producer
+ * waits while the queue is full, so a fast stage can not run arbitrarily far ahead of a slow one. Closing the queue wakes
+ * every waiting thread: producers give up and consumers take what is left before they give up.
+ */
+template<typename T>
+class BoundedQueue
+{
+public:
+    /**
+     * A constructor for the bounded queue.
+     *
+     * @param capacity_ the most items that the queue holds at once, require that it is positive.
+     */
+    explicit BoundedQueue(size_t capacity_)
+        : capacity(capacity_)
+    {}
+
+    /**
+     * Adds an item, waiting for room if the queue is full.
+     *
+     * @param data the item that will be added.
+     * @return true if the item was added and false if the queue was closed.
+     */
+    bool push(T data)
+    {
+        std::unique_lock<std::mutex> lk(m);
+        not_full.wait(lk, [this] { return closed || queue.size() < capacity; });
+        if (closed)
+            return false;
+        queue.push(std::move(data));
+        not_empty.notify_one();
+        return true;
+    }
+
+    /**
+     * Removes the oldest item, waiting for one if the queue is empty.
+     *
+     * @param data the location that the item will be moved to.
+     * @return true if an item was removed and false if the queue was closed and is empty.
+     */
+    bool pop(T &data)
+    {
+        std::unique_lock<std::mutex> lk(m);
+        not_empty.wait(lk, [this] { return closed || !queue.empty(); });
+        if (queue.empty())
+            return false;
+        data = std::move(queue.front());
+        queue.pop();
+        not_full.notify_one();
+        return true;
+    }
+
+    /**
+     * Stops the queue from taking any more items and wakes every thread that is waiting on it.
+     */
+    void close()
+    {
+        std::lock_guard<std::mutex> lk(m);
+        closed = true;
+        not_full.notify_all();
+        not_empty.notify_all();
+    }
+
+private:
+    std::mutex m;
+    std::condition_variable not_full;
+    std::condition_variable not_empty;
+    std::queue<T> queue;
+    const size_t capacity;
+    bool closed = false;
+};
+} // namespace Concurrent
+#endif // CONCURRENT_HUFFMAN_BOUNDED_QUEUE_H
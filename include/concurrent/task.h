@@ -1,5 +1,6 @@
 #ifndef CONCURRENT_HUFFMAN_TASK_H
 #define CONCURRENT_HUFFMAN_TASK_H
+#include <chrono>
 #include <memory>
 namespace Concurrent {
 class Task
@@ -11,17 +12,20 @@ public:
     Task() = default;
 
     template<typename F>
-    Task(F &&f_)
+    Task(F &&f_, std::chrono::steady_clock::time_point submit_time_ = std::chrono::steady_clock::time_point())
         : callable(new CallableType<F>(std::forward<F>(f_)))
+        , submit_time(submit_time_)
     {}
 
     Task(Task &&other) noexcept
         : callable(std::move(other.callable))
+        , submit_time(other.submit_time)
     {}
 
     Task &operator=(Task &&other) noexcept
     {
         callable = std::move(other.callable);
+        submit_time = other.submit_time;
         return *this;
     }
 
@@ -30,6 +34,12 @@ public:
         callable->call();
     }
 
+    // The time that the task was handed to a thread pool.
+    std::chrono::steady_clock::time_point submitTime() const
+    {
+        return submit_time;
+    }
+
 private:
     struct Callable
     {
@@ -37,6 +47,7 @@ private:
         virtual ~Callable() = default;
     };
     std::unique_ptr<Callable> callable;
+    std::chrono::steady_clock::time_point submit_time;
 
     template<typename F>
     struct CallableType : Callable
@@ -1,14 +1,30 @@
 #ifndef CONCURRENT_HUFFMAN_THREAD_POOL_H
 #define CONCURRENT_HUFFMAN_THREAD_POOL_H
+#include <algorithm>
+#include <array>
 #include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <thread>
 #include <cassert>
 #include <future>
-#include "queue.h"
+#include <mutex>
+#include <memory>
+#include "work_stealing_queue.h"
 #include "thread_joiner.h"
+#include "thread_pool_stats.h"
 #include "task.h"
 
 namespace Concurrent {
+/**
+ * A thread pool in which every worker has its own queue of tasks. Tasks submitted by a worker go to the worker's own
+ * queue and tasks submitted by any other thread are spread over the workers' queues, so workers rarely contend for the
+ * same lock. A worker whose queue is empty steals tasks from the other workers. A worker that finds no work spins for
+ * a while and then sleeps until a task is submitted, so an idle pool does not use any CPU time.
+ *
+ * Every worker keeps its own counters of the tasks that it ran and of the time that it was busy, which can be read as
+ * a snapshot with stats() while the pool runs.
+ */
 class ThreadPool
 {
 public:
@@ -18,15 +34,28 @@ public:
         , thread_joiner(threads)
     {
         assert(num_threads >= 1 && "Thread pool requires at least 1 thread!");
+        queues.reserve(num_threads);
+        for (uint32_t i = 0; i < num_threads; ++i)
+            queues.push_back(std::make_unique<WorkStealingQueue>());
+        // The last counters are shared by the threads outside of the pool that run tasks while they wait.
+        counters.reserve(num_threads + 1);
+        for (uint32_t i = 0; i <= num_threads; ++i)
+            counters.push_back(std::make_unique<WorkerCounters>());
         threads.reserve(num_threads);
         try
         {
             for (uint32_t i = 0; i < num_threads; ++i)
-                threads.emplace_back(&ThreadPool::workerThread, this);
+                threads.emplace_back(&ThreadPool::workerThread, this, i);
         }
         catch (...)
         {
-            running = false;
+            // The workers that did start may already be asleep, so wake them up to see that the pool is shutting down
+            // before the joiner waits for them.
+            {
+                std::lock_guard<std::mutex> lk(sleep_mutex);
+                running = false;
+            }
+            wake_up.notify_all();
             throw;
         }
     }
@@ -35,40 +64,255 @@ public:
     std::future<typename std::result_of<Function()>::type> submitTask(Function f)
     {
         using result_type = typename std::result_of<Function()>::type;
-        std::packaged_task<result_type()> task(std::move(f));
-        std::future<result_type> result(task.get_future());
-        task_queue.push(std::move(task));
+        std::packaged_task<result_type()> packaged_task(std::move(f));
+        std::future<result_type> result(packaged_task.get_future());
+        Task task(std::move(packaged_task), std::chrono::steady_clock::now());
+        // A worker pushes to its own queue. Any other thread deals its tasks out over the queues from a position of its
+        // own, so that threads outside of the pool do not share a counter either.
+        if (local_pool == this)
+            queues[local_index]->push(std::move(task));
+        else
+            queues[submit_index++ % num_threads]->push(std::move(task));
+        // The queue stores its new depth before the check for sleeping workers. A worker that is going to sleep counts
+        // itself as sleeping before it looks at the depths of the queues, so either it sees the task or this thread sees
+        // it sleeping.
+        if (sleeping_workers.load() != 0)
+        {
+            // Taking the lock makes sure that a worker that is about to sleep either sees the task or gets the notification.
+            std::lock_guard<std::mutex> lk(sleep_mutex);
+            wake_up.notify_one();
+        }
         return result;
     }
 
-    uint8_t numberOfWorkers() const
+    /**
+     * Runs a single pending task, or yields if there is none. A task that waits for other tasks of the same pool should
+     * call this while it waits, otherwise the pool can run out of workers to run the tasks being waited for.
+     */
+    void runPendingTask()
+    {
+        Task task;
+        if (popTask(task))
+        {
+            recordWait(task, std::chrono::steady_clock::now());
+            task();
+        }
+        else
+        {
+            std::this_thread::yield();
+        }
+    }
+
+    uint32_t numberOfWorkers() const
     {
         return num_threads;
     }
 
+    /**
+     * @return true if the calling thread is one of the workers of this pool, which is the case while it runs a task that
+     *         a worker took from a queue.
+     */
+    bool isWorkerThread() const
+    {
+        return local_pool == this;
+    }
+
+    /**
+     * @return a snapshot of the counters of the pool and of each of its workers since the pool was started.
+     */
+    ThreadPoolStats stats() const
+    {
+        ThreadPoolStats snapshot;
+        snapshot.workers.resize(num_threads);
+        for (uint32_t i = 0; i <= num_threads; ++i)
+        {
+            const WorkerCounters &worker_counters = *counters[i];
+            WorkerStats &worker = i < num_threads ? snapshot.workers[i] : snapshot.callers;
+            worker.tasks_executed = worker_counters.tasks_executed.load(std::memory_order_relaxed);
+            worker.tasks_stolen = worker_counters.tasks_stolen.load(std::memory_order_relaxed);
+            worker.busy_time = std::chrono::nanoseconds(worker_counters.busy_time.load(std::memory_order_relaxed));
+            worker.idle_time = std::chrono::nanoseconds(worker_counters.idle_time.load(std::memory_order_relaxed));
+            for (size_t bucket = 0; bucket < ThreadPoolStats::num_wait_buckets; ++bucket)
+                snapshot.wait_histogram[bucket] += worker_counters.wait_histogram[bucket].load(std::memory_order_relaxed);
+        }
+        for (const auto &queue : queues)
+        {
+            snapshot.queue_depth += queue->size();
+            snapshot.max_queue_depth = std::max(snapshot.max_queue_depth, queue->maxSize());
+        }
+        // Every task that was submitted has either been taken from a queue or is still in one.
+        snapshot.tasks_submitted = snapshot.callers.tasks_executed + snapshot.queue_depth;
+        for (const WorkerStats &worker : snapshot.workers)
+            snapshot.tasks_submitted += worker.tasks_executed;
+        return snapshot;
+    }
+
     ~ThreadPool()
     {
-        running = false;
+        {
+            std::lock_guard<std::mutex> lk(sleep_mutex);
+            running = false;
+        }
+        wake_up.notify_all();
     }
 
 private:
+    // The counters of a single worker, each on its own cache line so that workers do not slow each other down.
+    struct alignas(64) WorkerCounters
+    {
+        std::atomic<uint64_t> tasks_executed{0};
+        std::atomic<uint64_t> tasks_stolen{0};
+        std::atomic<int64_t> busy_time{0};
+        std::atomic<int64_t> idle_time{0};
+        std::array<std::atomic<uint64_t>, ThreadPoolStats::num_wait_buckets> wait_histogram{};
+    };
+
     uint32_t num_threads;
     std::atomic_bool running;
-    Queue<Task> task_queue;
+    std::atomic<uint32_t> sleeping_workers{0};
+    std::mutex sleep_mutex;
+    std::condition_variable wake_up;
+    std::vector<std::unique_ptr<WorkStealingQueue>> queues;
+    std::vector<std::unique_ptr<WorkerCounters>> counters;
     std::vector<std::thread> threads;
     ThreadJoiner thread_joiner;
 
-    void workerThread()
+    // The pool that the worker running on this thread belongs to, and the index of its queue.
+    inline static thread_local ThreadPool *local_pool = nullptr;
+    inline static thread_local uint32_t local_index = 0;
+    // The queue that the next task submitted by a thread outside of the pool goes to, which starts at a place that depends
+    // on the thread so that threads that submit at the same time start on different queues.
+    inline static thread_local uint32_t submit_index = static_cast<uint32_t>(std::hash<std::thread::id>()(std::this_thread::get_id()));
+
+    // The bounds on the number of times an idle worker looks for work before it goes to sleep.
+    static constexpr uint32_t min_spin_rounds = 16;
+    static constexpr uint32_t max_spin_rounds = 1024;
+
+    void workerThread(uint32_t index)
     {
+        local_pool = this;
+        local_index = index;
+        uint32_t spin_limit = max_spin_rounds;
+        uint32_t spin_rounds = 0;
+        // The clock is read once when a task starts and once when a run of tasks ends, so a worker that runs tasks back
+        // to back reads it once per task. The time in between is busy while the worker is running tasks and idle otherwise.
+        WorkerCounters &worker_counters = *counters[index];
+        auto last_time = std::chrono::steady_clock::now();
+        bool is_busy = false;
         while (running)
         {
             Task task;
-            if (task_queue.tryPop(task))
+            if (popTask(task))
+            {
+                // Work that shows up while spinning suggests more will follow soon, so spin for longer next time.
+                if (spin_rounds != 0)
+                    spin_limit = std::min(spin_limit * 2, max_spin_rounds);
+                spin_rounds = 0;
+                const auto task_start = std::chrono::steady_clock::now();
+                addTime(is_busy ? worker_counters.busy_time : worker_counters.idle_time, task_start - last_time);
+                last_time = task_start;
+                is_busy = true;
+                recordWait(task, task_start);
                 task();
-            else
+                continue;
+            }
+            if (is_busy)
+            {
+                const auto now = std::chrono::steady_clock::now();
+                addTime(worker_counters.busy_time, now - last_time);
+                last_time = now;
+                is_busy = false;
+            }
+            if (++spin_rounds < spin_limit)
+            {
                 std::this_thread::yield();
+            }
+            else
+            {
+                // Spinning did not pay off, so give up sooner next time.
+                spin_limit = std::max(spin_limit / 2, min_spin_rounds);
+                spin_rounds = 0;
+                // Count the idle time so far, so that a worker that sleeps for a long time is not shown as busy.
+                const auto now = std::chrono::steady_clock::now();
+                addTime(worker_counters.idle_time, now - last_time);
+                last_time = now;
+                sleep();
+            }
         }
     }
+
+    void sleep()
+    {
+        std::unique_lock<std::mutex> lk(sleep_mutex);
+        sleeping_workers.fetch_add(1);
+        wake_up.wait(lk, [this] { return hasPendingTask() || !running; });
+        sleeping_workers.fetch_sub(1);
+    }
+
+    bool hasPendingTask() const
+    {
+        return std::any_of(queues.begin(), queues.end(), [](const auto &queue) { return queue->size() != 0; });
+    }
+
+    bool popTask(Task &task)
+    {
+        const bool is_worker = local_pool == this;
+        WorkerCounters &worker_counters = *counters[is_worker ? local_index : num_threads];
+        if (is_worker && queues[local_index]->tryPop(task))
+        {
+            addToCounter(worker_counters.tasks_executed, 1, is_worker);
+            return true;
+        }
+        // Steal from the other queues, starting with the next one along so that thieves spread out over the victims.
+        for (uint32_t i = 1; i <= num_threads; ++i)
+        {
+            const uint32_t index = (local_index + i) % num_threads;
+            if ((!is_worker || index != local_index) && queues[index]->trySteal(task))
+            {
+                addToCounter(worker_counters.tasks_executed, 1, is_worker);
+                if (is_worker)
+                    addToCounter(worker_counters.tasks_stolen, 1, is_worker);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /**
+     * Adds the time that a task waited in its queue to the histogram of the thread that is about to run it.
+     *
+     * @param task the task that is about to run.
+     * @param task_start the time that the task starts to run.
+     */
+    void recordWait(const Task &task, std::chrono::steady_clock::time_point task_start)
+    {
+        const auto wait_time = std::chrono::duration_cast<std::chrono::nanoseconds>(task_start - task.submitTime());
+        const size_t bucket = ThreadPoolStats::waitBucket(wait_time);
+        const bool is_worker = local_pool == this;
+        addToCounter(counters[is_worker ? local_index : num_threads]->wait_histogram[bucket], 1, is_worker);
+    }
+
+    /**
+     * Adds to a counter. The counters of a worker are only written by the worker itself, which can update them without
+     * an atomic read-modify-write; the counters shared by the threads outside of the pool need one.
+     *
+     * @param counter the counter that will be added to.
+     * @param amount the amount that will be added.
+     * @param is_owner whether the counter belongs to the worker running on this thread.
+     */
+    template<typename T>
+    static void addToCounter(std::atomic<T> &counter, typename std::atomic<T>::value_type amount, bool is_owner)
+    {
+        if (is_owner)
+            counter.store(counter.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+        else
+            counter.fetch_add(amount, std::memory_order_relaxed);
+    }
+
+    static void addTime(std::atomic<int64_t> &counter, std::chrono::steady_clock::duration time)
+    {
+        addToCounter(counter, std::chrono::duration_cast<std::chrono::nanoseconds>(time).count(), true);
+    }
 };
 } // namespace Concurrent
 #endif // CONCURRENT_HUFFMAN_THREAD_POOL_H
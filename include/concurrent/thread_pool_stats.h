@@ -0,0 +1,107 @@
+#ifndef CONCURRENT_HUFFMAN_THREAD_POOL_STATS_H
+#define CONCURRENT_HUFFMAN_THREAD_POOL_STATS_H
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+namespace Concurrent {
+// What a single worker of a thread pool has done since the pool was started.
+struct WorkerStats
+{
+    // The number of tasks that the worker ran, including the tasks that it stole.
+    uint64_t tasks_executed = 0;
+    // The number of tasks that the worker took from the queue of another worker.
+    uint64_t tasks_stolen = 0;
+    // The time that the worker spent running tasks and looking for or waiting for tasks. Both are brought up to date
+    // whenever the worker starts a task or goes to sleep, so a worker that has been idle since then is not counted yet.
+    std::chrono::nanoseconds busy_time{0};
+    std::chrono::nanoseconds idle_time{0};
+};
+
+/**
+ * A snapshot of the counters of a thread pool, taken while the pool runs. Each counter is read on its own, so counters
+ * that are updated while the snapshot is taken may be slightly out of step with each other.
+ */
+struct ThreadPoolStats
+{
+    // The number of buckets of the histogram of the time that tasks waited in a queue.
+    static constexpr size_t num_wait_buckets = 32;
+
+    // The counters of each worker of the pool.
+    std::vector<WorkerStats> workers;
+    // The tasks that were run by threads outside of the pool while they waited for other tasks. Their time is not counted.
+    WorkerStats callers;
+    // The number of tasks that were submitted to the pool.
+    uint64_t tasks_submitted = 0;
+    // The number of tasks that are waiting in a queue, and the largest number that a single queue ever held at the same
+    // time. Each queue keeps its own high-water mark, so that submitting a task does not touch a counter that every
+    // thread shares.
+    uint64_t queue_depth = 0;
+    uint64_t max_queue_depth = 0;
+    // The number of tasks whose time between being submitted and starting to run fell in each bucket. Bucket zero holds
+    // waits of no time at all, bucket i holds waits of at least 2^(i - 1) and less than 2^i nanoseconds, and the last
+    // bucket also holds every longer wait.
+    std::array<uint64_t, num_wait_buckets> wait_histogram{};
+
+    /**
+     * @param wait_time the time that a task waited before it started to run.
+     * @return the bucket of the histogram that the wait falls in.
+     */
+    static size_t waitBucket(std::chrono::nanoseconds wait_time)
+    {
+        if (wait_time.count() <= 0)
+            return 0;
+        const auto bucket = static_cast<size_t>(64 - __builtin_clzll(static_cast<uint64_t>(wait_time.count())));
+        return bucket < num_wait_buckets ? bucket : num_wait_buckets - 1;
+    }
+
+    /**
+     * @param bucket a bucket of the histogram.
+     * @return the time that every wait in the bucket is shorter than, except for the waits in the last bucket.
+     */
+    static std::chrono::nanoseconds waitBucketLimit(size_t bucket)
+    {
+        return std::chrono::nanoseconds(int64_t(1) << bucket);
+    }
+
+    /**
+     * @param fraction the share of the tasks, require that it is between zero and one.
+     * @return a time that at least the given share of the tasks waited less than, rounded up to the limit of a bucket.
+     */
+    std::chrono::nanoseconds waitTimePercentile(double fraction) const
+    {
+        uint64_t num_waits = 0;
+        for (const uint64_t count : wait_histogram)
+            num_waits += count;
+        const auto target = static_cast<uint64_t>(fraction * static_cast<double>(num_waits));
+        uint64_t seen = 0;
+        for (size_t bucket = 0; bucket < num_wait_buckets; ++bucket)
+        {
+            seen += wait_histogram[bucket];
+            if (seen >= target && seen != 0)
+                return waitBucketLimit(bucket);
+        }
+        return std::chrono::nanoseconds(0);
+    }
+
+    /**
+     * @return the share of their time that the workers spent running tasks, or zero if no time was counted yet. A low
+     *         value while the pool has work means that the tasks are too small to keep the workers busy.
+     */
+    double utilization() const
+    {
+        std::chrono::nanoseconds busy_time{0};
+        std::chrono::nanoseconds total_time{0};
+        for (const WorkerStats &worker : workers)
+        {
+            busy_time += worker.busy_time;
+            total_time += worker.busy_time + worker.idle_time;
+        }
+        if (total_time.count() == 0)
+            return 0;
+        return static_cast<double>(busy_time.count()) / static_cast<double>(total_time.count());
+    }
+};
+} // namespace Concurrent
+#endif // CONCURRENT_HUFFMAN_THREAD_POOL_STATS_H
@@ -0,0 +1,88 @@
+#ifndef CONCURRENT_HUFFMAN_WORK_STEALING_QUEUE_H
+#define CONCURRENT_HUFFMAN_WORK_STEALING_QUEUE_H
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include "task.h"
+
+namespace Concurrent {
+/**
+ * A queue of tasks that belongs to a single worker. The owner pushes and pops tasks at the front, so the task it
+ * submitted most recently, whose data is most likely still in cache, runs first. Other workers steal from the back.
+ *
+ * The queue keeps its own depth and the largest depth it ever reached, so that the pool can tell whether there is work
+ * and report its counters without a counter that every queue shares. Each queue starts on its own cache line.
+ */
+class alignas(64) WorkStealingQueue
+{
+public:
+    WorkStealingQueue() = default;
+    WorkStealingQueue(const WorkStealingQueue &other) = delete;
+    WorkStealingQueue &operator=(const WorkStealingQueue &other) = delete;
+
+    void push(Task data)
+    {
+        std::lock_guard<std::mutex> lk(m);
+        queue.push_front(std::move(data));
+        // The new depth is stored in sequence with the pool's check for sleeping workers that follows the push.
+        const uint64_t size = queue.size();
+        depth.store(size);
+        if (size > max_depth.load(std::memory_order_relaxed))
+            max_depth.store(size, std::memory_order_relaxed);
+    }
+
+    bool tryPop(Task &data)
+    {
+        std::lock_guard<std::mutex> lk(m);
+        if (queue.empty())
+            return false;
+        data = std::move(queue.front());
+        queue.pop_front();
+        depth.store(queue.size(), std::memory_order_relaxed);
+        return true;
+    }
+
+    bool trySteal(Task &data)
+    {
+        std::lock_guard<std::mutex> lk(m);
+        if (queue.empty())
+            return false;
+        data = std::move(queue.back());
+        queue.pop_back();
+        depth.store(queue.size(), std::memory_order_relaxed);
+        return true;
+    }
+
+    bool empty() const
+    {
+        std::lock_guard<std::mutex> lk(m);
+        return queue.empty();
+    }
+
+    /**
+     * @return the number of tasks in the queue, read without taking the lock, so it may be out of date by the time the
+     *         caller looks at it.
+     */
+    uint64_t size() const
+    {
+        return depth.load();
+    }
+
+    /**
+     * @return the largest number of tasks that the queue has held at the same time.
+     */
+    uint64_t maxSize() const
+    {
+        return max_depth.load(std::memory_order_relaxed);
+    }
+
+private:
+    mutable std::mutex m;
+    std::deque<Task> queue;
+    // Only written while the lock is held, and read without it.
+    std::atomic<uint64_t> depth{0};
+    std::atomic<uint64_t> max_depth{0};
+};
+} // namespace Concurrent
+#endif // CONCURRENT_HUFFMAN_WORK_STEALING_QUEUE_H
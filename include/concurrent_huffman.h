@@ -1,12 +1,37 @@
 #ifndef CONCURRENT_HUFFMAN_CONCURRENT_HUFFMAN_H
 #define CONCURRENT_HUFFMAN_CONCURRENT_HUFFMAN_H
+#include <algorithm>
 #include <vector>
 #include <string>
+#include <string_view>
 #include <unordered_map>
+#include <utility>
 #include <thread>
+#include "compression_options.h"
+#include "compression_result.h"
+#include "compression_stats.h"
+#include "thread_pool.h"
 
+/**
+ * Every function takes a thread pool owned by the caller, which saves the cost of starting threads on every call; this
+ * matters most when many small files or strings are processed. defaultPool() is a pool that the whole process can share.
+ * The settings and the statistics of a call are optional. A pool may be shared by calls made from several threads at
+ * once, but a call must not be made from a task that is running on the same pool, since the call waits for the tasks
+ * that it submits and the pool could run out of workers to run them. Such a call throws a std::logic_error. compressFiles
+ * itself compresses small files inside tasks of the pool, which is safe because a file of a single block is compressed
+ * without submitting any tasks.
+ *
+ * compressFile and decompressFile also keep their original form, which takes a number of threads and starts up and
+ * shuts down a thread pool of that size for the call.
+ */
 struct ConcurrentHuffman
 {
+    /**
+     * @return a thread pool that is shared by the whole process, which is started on first use and has one worker less
+     *         than the number of hardware threads, or one worker if there is only one hardware thread.
+     */
+    static Concurrent::ThreadPool &defaultPool();
+
     /**
      * Compresses a file.
      *
@@ -16,7 +41,35 @@ struct ConcurrentHuffman
      * @param num_threads the number of threads to use during file compression, require num_threads is positive.
      */
     static void compressFile(const std::string &file_to_compress, const std::string &compressed_file,
-        uint32_t num_threads = std::thread::hardware_concurrency() - 1);
+        uint32_t num_threads = std::max(std::thread::hardware_concurrency(), 2u) - 1);
+
+    /**
+     * Compresses a file using the threads of an existing pool.
+     *
+     * @param file_to_compress the file that will be compressed, require that the file exists
+     *                         and that the file is not already compressed.
+     * @param compressed_file the name of the compressed file that will be created.
+     * @param pool the thread pool that will run the tasks of the call, require that the call is not made from a task that is
+     *             running on the pool, otherwise a std::logic_error is thrown.
+     * @param options the settings used to compress the file.
+     * @param stats the statistics of the call are written here if it is not a null pointer, replacing its contents.
+     */
+    static void compressFile(const std::string &file_to_compress, const std::string &compressed_file, Concurrent::ThreadPool &pool,
+        const CompressionOptions &options = CompressionOptions(), CompressionStats *stats = nullptr);
+
+    /**
+     * Compresses a batch of files. The files are compressed side by side, so every thread has work to do even when the
+     * files are much smaller than a block. A file that cannot be compressed does not stop the rest of the batch, the
+     * exception that it threw is reported in its result instead.
+     *
+     * @param files pairs of the file that will be compressed and the name of the compressed file that will be created.
+     * @param pool the thread pool that will run the tasks of the call, require that the call is not made from a task that is
+     *             running on the pool, otherwise a std::logic_error is thrown.
+     * @param options the settings used to compress every file.
+     * @return the result of compressing each file, in the same order as the files.
+     */
+    static std::vector<CompressionResult> compressFiles(const std::vector<std::pair<std::string, std::string>> &files,
+        Concurrent::ThreadPool &pool, const CompressionOptions &options = CompressionOptions());
 
     /**
      * Decompresses a file.
@@ -27,6 +80,71 @@ struct ConcurrentHuffman
      * @param num_threads the number of threads to use during file decompression, require that num_threads is positive.
      */
     static void decompressFile(const std::string &file_to_decompress, const std::string &decompressed_file,
-        uint32_t num_threads = std::thread::hardware_concurrency() - 1);
+        uint32_t num_threads = std::max(std::thread::hardware_concurrency(), 2u) - 1);
+
+    /**
+     * Decompresses a file using the threads of an existing pool.
+     *
+     * @param file_to_decompress the file that will be decompressed, require that the file exists
+     *                           and that file is compressed.
+     * @param decompressed_file the name of the decompressed file that will be created.
+     * @param pool the thread pool that will run the tasks of the call, require that the call is not made from a task that is
+     *             running on the pool, otherwise a std::logic_error is thrown.
+     * @param stats the statistics of the call are written here if it is not a null pointer, replacing its contents.
+     */
+    static void decompressFile(const std::string &file_to_decompress, const std::string &decompressed_file, Concurrent::ThreadPool &pool,
+        CompressionStats *stats = nullptr);
+
+    /**
+     * Decompresses a range of a file. Only the parts of the compressed file that hold the range are read and decoded.
+     *
+     * @param file_to_decompress the file that will be decompressed, require that the file exists and that file is compressed.
+     * @param offset the position in the decompressed file of the first byte of the range.
+     * @param length the number of bytes in the range, require that the range is within the decompressed file.
+     * @param pool the thread pool that will run the tasks of the call, require that the call is not made from a task that is
+     *             running on the pool, otherwise a std::logic_error is thrown.
+     * @return the decompressed range.
+     */
+    static std::string decompressRange(
+        const std::string &file_to_decompress, uint64_t offset, uint64_t length, Concurrent::ThreadPool &pool);
+
+    /**
+     * Checks the integrity of a compressed file without writing anything. Every block is decoded and, if the file was
+     * compressed with checksums, compared against its checksum. Throws a std::runtime_error describing the problem if
+     * the file is damaged.
+     *
+     * @param file_to_verify the file that will be checked, require that the file exists.
+     * @param pool the thread pool that will run the tasks of the call, require that the call is not made from a task that is
+     *             running on the pool, otherwise a std::logic_error is thrown.
+     */
+    static void verifyFile(const std::string &file_to_verify, Concurrent::ThreadPool &pool);
+
+    /**
+     * Compresses text that is held in memory, without touching the file system, into a buffer owned by the caller.
+     * Reusing the buffer between calls reuses its memory.
+     *
+     * @param text the text that will be compressed.
+     * @param compressed the buffer that the compressed text will be written to, in the same format as a compressed file.
+     *                   Its contents are replaced.
+     * @param pool the thread pool that will run the tasks of the call, require that the call is not made from a task that is
+     *             running on the pool, otherwise a std::logic_error is thrown.
+     * @param options the settings used to compress the text.
+     * @param stats the statistics of the call are written here if it is not a null pointer, replacing its contents.
+     */
+    static void compress(std::string_view text, std::string &compressed, Concurrent::ThreadPool &pool,
+        const CompressionOptions &options = CompressionOptions(), CompressionStats *stats = nullptr);
+
+    /**
+     * Decompresses text that is held in memory, without touching the file system, into a buffer owned by the caller.
+     * Reusing the buffer between calls reuses its memory.
+     *
+     * @param compressed the compressed text, require that it was produced by compress or read from a compressed file.
+     * @param decompressed the buffer that the decompressed text will be written to, its contents are replaced.
+     * @param pool the thread pool that will run the tasks of the call, require that the call is not made from a task that is
+     *             running on the pool, otherwise a std::logic_error is thrown.
+     * @param stats the statistics of the call are written here if it is not a null pointer, replacing its contents.
+     */
+    static void decompress(
+        std::string_view compressed, std::string &decompressed, Concurrent::ThreadPool &pool, CompressionStats *stats = nullptr);
 };
 #endif // CONCURRENT_HUFFMAN_CONCURRENT_HUFFMAN_H
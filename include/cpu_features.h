@@ -0,0 +1,37 @@
+#ifndef CONCURRENT_HUFFMAN_CPU_FEATURES_H
+#define CONCURRENT_HUFFMAN_CPU_FEATURES_H
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+// Kernels that use x86-64 instruction set extensions are built next to the portable kernels and picked at run time.
+#define CONCURRENT_HUFFMAN_X86_KERNELS
+// Compiles a function for CPUs that have the listed extensions and inlines every call that it makes, so that all of the
+// code it runs is compiled for them. The caller must check that the CPU has the extensions first.
+#define CONCURRENT_HUFFMAN_TARGET(extensions) __attribute__((target(extensions), flatten))
+#endif
+
+/**
+ * The instruction set extensions that the encoding, decoding, and checksum kernels may use. The CPU is checked once, so a
+ * single binary uses the fastest kernels that every machine it runs on supports. Every kernel has a portable version
+ * that produces the same output, which is used on other CPUs and architectures and when the extensions are turned off.
+ */
+struct CpuFeatures
+{
+    /**
+     * @return true if the kernels may use BMI2 and false otherwise.
+     */
+    static bool hasBmi2();
+
+    /**
+     * @return true if the kernels may use SSE4.2 and false otherwise.
+     */
+    static bool hasSse42();
+
+    /**
+     * Allows or forbids the kernels that use instruction set extensions in the whole process. They are allowed by
+     * default, unless the environment variable CONCURRENT_HUFFMAN_KERNELS is set to "portable" when the process starts.
+     *
+     * @param enabled true to use the extensions that the CPU has and false to only use the portable kernels.
+     */
+    static void setExtensionsEnabled(bool enabled);
+};
+#endif // CONCURRENT_HUFFMAN_CPU_FEATURES_H
@@ -0,0 +1,18 @@
+#ifndef CONCURRENT_HUFFMAN_CRC32C_H
+#define CONCURRENT_HUFFMAN_CRC32C_H
+#include <cstddef>
+#include <cstdint>
+
+struct Crc32c
+{
+    /**
+     * Computes the CRC-32C (Castagnoli) checksum of a range of bytes. The bytes are processed eight at a time, with the
+     * crc32 instruction on CPUs that have SSE4.2 and with eight lookup tables otherwise.
+     *
+     * @param data the bytes that will be checksummed.
+     * @param size the number of bytes in data.
+     * @return the checksum of the bytes.
+     */
+    static uint32_t compute(const unsigned char *data, size_t size);
+};
+#endif // CONCURRENT_HUFFMAN_CRC32C_H
@@ -1,17 +1,36 @@
 #ifndef CONCURRENT_HUFFMAN_DECODER_H
 #define CONCURRENT_HUFFMAN_DECODER_H
+#include <array>
 #include <string>
+#include <future>
+#include <memory>
+#include <string_view>
 #include <unordered_map>
+#include <utility>
 #include <vector>
+#include "code.h"
+#include "compression_stats.h"
+#include "cpu_features.h"
+#include "decoding_table.h"
+#include "format.h"
 #include "thread_pool.h"
 
-// Used to store the data needed for file decompression that
-// is retrieved from the compressed file.
-struct HeaderData
+// A frame of a compressed file, along with where it is in both the compressed and the decompressed file.
+struct FrameLayout
 {
-    std::unordered_map<std::string, char> decoding_table;
-    std::vector<uint32_t> block_offsets;
-    uint8_t padding;
+    FrameHeader frame_header;
+    // The position of the encoded text of the frame in the compressed file.
+    uint64_t encoded_start = 0;
+    // The position of the first byte of the frame in the decompressed file.
+    uint64_t decoded_start = 0;
+};
+
+// The layout of a compressed file, which is read from its header and the block index of each of its frames.
+struct CompressedLayout
+{
+    HeaderData header_data;
+    std::vector<FrameLayout> frames;
+    uint64_t decompressed_size = 0;
 };
 
 class Decoder
@@ -20,64 +39,315 @@ public:
     /**
      * Decompresses a compressed file.
      *
+     * @param pool the thread pool that will be used for task submission, require that the thread pool has already been started.
      * @param file_to_decompress the name of the file that will be decompressed, require that the file
      *                           exists and is compressed.
      * @param decompressed_file the name of the decompressed file that will be created.
-     * @param num_threads the number of threads that will be using during file decompression, require that num_threads is positive.
+     * @param stats the statistics of the call are written here if it is not a null pointer.
+     */
+    static void decompressFile(Concurrent::ThreadPool &pool, const std::string &file_to_decompress, const std::string &decompressed_file,
+        CompressionStats *stats = nullptr);
+
+    /**
+     * Decompresses compressed text that is held in memory.
+     *
+     * @param pool the thread pool that will be used for task submission, require that the thread pool has already been started.
+     * @param compressed the compressed text, require that it was produced by the encoder.
+     * @param decompressed the buffer that the decompressed text will be written to, its contents are replaced.
+     * @param stats the statistics of the call are written here if it is not a null pointer.
      */
-    static void decompressFile(const std::string &file_to_decompress, const std::string &decompressed_file, uint32_t num_threads);
+    static void decompress(
+        Concurrent::ThreadPool &pool, std::string_view compressed, std::string &decompressed, CompressionStats *stats = nullptr);
+
+    /**
+     * Decompresses a range of a compressed file. Only the blocks that hold part of the range are read and decoded.
+     *
+     * @param pool the thread pool that will be used for task submission, require that the thread pool has already been started.
+     * @param file_to_decompress the name of the file that will be decompressed, require that the file exists and is compressed.
+     * @param offset the position in the decompressed file of the first byte of the range.
+     * @param length the number of bytes in the range, require that the range is within the decompressed file.
+     * @return the decompressed range.
+     */
+    static std::string decompressRange(
+        Concurrent::ThreadPool &pool, const std::string &file_to_decompress, uint64_t offset, uint64_t length);
+
+    /**
+     * Checks that every block of a compressed file can be decoded and, if the file has checksums, that every decoded
+     * block matches its checksum. The blocks are checked in parallel and nothing is written.
+     *
+     * @param pool the thread pool that will be used for task submission, require that the thread pool has already been started.
+     * @param file_to_verify the name of the file that will be checked, require that the file exists.
+     */
+    static void verifyFile(Concurrent::ThreadPool &pool, const std::string &file_to_verify);
 
 private:
+    // The decoding tables that the blocks of a frame are decoded with.
+    struct FrameDecodingTables
+    {
+        // The table built from the code lengths in the header of the file.
+        const DecodingTable *file_table = nullptr;
+        // The tables built from the code tables of the frame, null for the tables that no block being decoded uses.
+        std::vector<std::unique_ptr<DecodingTable>> frame_tables;
+    };
+
+    /**
+     * Builds the decoding tables that a run of blocks of a frame is decoded with.
+     *
+     * @param file_table the table built from the code lengths in the header of the file.
+     * @param frame_header the block index of the frame.
+     * @param first_block the index of the first block of the run.
+     * @param end_block the index one past the last block of the run.
+     * @return the decoding tables of the frame, only the tables that the run uses are built.
+     */
+    static FrameDecodingTables constructDecodingTables(
+        const DecodingTable &file_table, const FrameHeader &frame_header, uint64_t first_block, uint64_t end_block);
+
+    /**
+     * @param decoding_tables the decoding tables of a frame, require that the table of the block has been built.
+     * @param frame_header the block index of the frame.
+     * @param block the index of a block in the frame.
+     * @return the table that the block is decoded with.
+     */
+    static const DecodingTable &blockTable(const FrameDecodingTables &decoding_tables, const FrameHeader &frame_header, uint64_t block);
+
+    /**
+     * Reads the header of compressed text and the block index of every frame.
+     *
+     * @param compressed the compressed text.
+     * @param compressed_size the number of bytes of compressed text.
+     * @return the layout of the compressed text.
+     */
+    static CompressedLayout readLayout(const unsigned char *compressed, uint64_t compressed_size);
+
+    /**
+     * Fills in the sizes and counts of a decompression that was asked for statistics.
+     *
+     * @param stats the statistics of the call, or a null pointer if the call is not collecting statistics.
+     * @param pool the thread pool that decoded the text.
+     * @param layout the layout of the compressed text.
+     * @param compressed_size the number of bytes of compressed text.
+     */
+    static void recordLayout(
+        CompressionStats *stats, const Concurrent::ThreadPool &pool, const CompressedLayout &layout, uint64_t compressed_size);
+
     /**
-     * Decodes a bit string from a compressed file.
+     * Decodes every frame of compressed text.
      *
      * @param pool the thread pool that will be used for task submission, require that the thread pool has already been started.
-     * @param header_data the decoding table, the block offsets, and the padding that has been added to bit string during the encoding
-     *                    process.
-     * @param bit_string the string of ones and zeros that will be decoded.
-     * @return the string created from decoding the bit string.
+     * @param layout the layout of the compressed text.
+     * @param compressed the compressed text.
+     * @param compressed_size the number of bytes of compressed text.
+     * @param decoded_text the location that the decoded text will be written to, require that it has room for the
+     *                     decompressed size of the layout.
      */
-    static std::string decodeBitString(Concurrent::ThreadPool &pool, const HeaderData &header_data, const std::string &bit_string);
+    static void decode(Concurrent::ThreadPool &pool, const CompressedLayout &layout, const unsigned char *compressed,
+        uint64_t compressed_size, char *decoded_text);
 
     /**
-     * Decodes a bit string from a compressed file.
+     * Decodes the encoded text of a frame from a compressed file.
      *
-     * @param decoding_table a hashmap that maps codes to their respective symbol.
-     * @param start an iterator to a bit string, decoding will start from this position.
-     * @param end an iterator to a bit string, decoding will stop at this position.
-     * @return a string created from decoding the bit string.
+     * @param pool the thread pool that will be used for task submission, require that the thread pool has already been started.
+     * @param decoding_tables the tables used to map codes to their respective symbol, require that the table of every
+     *                        block has been built.
+     * @param block_size the number of unencoded bytes in every block except for the last block of the frame.
+     * @param frame_header the block index of the frame.
+     * @param encoded_text the packed bits of the frame that will be decoded.
+     * @param encoded_size the number of bytes that can be read from encoded_text.
+     * @param decoded_text the location that the decoded frame will be written to, require that it has room for the
+     *                     uncompressed size of the frame.
+     */
+    static void decode(Concurrent::ThreadPool &pool, const FrameDecodingTables &decoding_tables, uint32_t block_size,
+        const FrameHeader &frame_header, const unsigned char *encoded_text, uint64_t encoded_size, char *decoded_text);
+
+    /**
+     * Decodes the part of a frame that overlaps with a range of the decompressed text.
+     *
+     * @param pool the thread pool that will be used for task submission, require that the thread pool has already been started.
+     * @param file_table the table built from the code lengths in the header of the file.
+     * @param decoding_tables the tables that the blocks of the range are decoded with, which are built by this call and
+     *                        must outlive the submitted tasks.
+     * @param block_size the number of unencoded bytes in every block except for the last block of the frame.
+     * @param frame the frame that will be decoded.
+     * @param encoded_text the packed bits of the frame.
+     * @param encoded_size the number of bytes that can be read from encoded_text.
+     * @param offset the position in the decompressed text of the first byte of the range.
+     * @param range the location that the range is decoded to, require that it has room for length bytes.
+     * @param length the number of bytes in the range.
+     * @param futures the tasks that decode the blocks of the frame that overlap with the range are added to the end of
+     *                these, each one as soon as it is submitted so that the caller can wait for all of them if a later
+     *                submission fails.
+     */
+    static void decodeRange(Concurrent::ThreadPool &pool, const DecodingTable &file_table, FrameDecodingTables &decoding_tables,
+        uint32_t block_size, const FrameLayout &frame, const unsigned char *encoded_text, uint64_t encoded_size, uint64_t offset,
+        char *range, uint64_t length, std::vector<std::future<void>> &futures);
+
+    /**
+     * Checks a decoded block against its checksum. Does nothing if the file does not have checksums.
+     *
+     * @param frame_header the block index of the frame that holds the block.
+     * @param block the index of the block in the frame.
+     * @param decoded_block the decoded block.
+     * @param size the number of symbols in the block.
+     */
+    static void verifyChecksum(const FrameHeader &frame_header, uint64_t block, const char *decoded_block, uint64_t size);
+
+    /**
+     * Decodes a block of the encoded text from a compressed file.
+     *
+     * @param decoding_table the table used to map codes to their respective symbol.
+     * @param encoded_text the packed bits that will be decoded.
+     * @param encoded_size the number of bytes that can be read from encoded_text.
+     * @param start_bit the position of the first bit of the block.
+     * @param end_bit the position one past the last bit of the block.
+     * @param output the location that the decoded block will be written to.
+     * @param size the number of symbols in the block.
+     */
+    static void decode(const DecodingTable &decoding_table, const unsigned char *encoded_text, uint64_t encoded_size, uint64_t start_bit,
+        uint64_t end_bit, char *output, uint64_t size);
+
+    /**
+     * Decodes a block of a frame, with decodeBlockWithBmi2 on CPUs that have BMI2 and with decodeBlockPortable otherwise.
+     *
+     * @param decoding_table the table used to map codes to their respective symbol.
+     * @param frame_header the block index of the frame that holds the block.
+     * @param block the index of the block in the frame.
+     * @param encoded_text the packed bits of the frame.
+     * @param encoded_size the number of bytes that can be read from encoded_text.
+     * @param start_bit the position of the first bit of the block.
+     * @param end_bit the position one past the last bit of the block.
+     * @param output the location that the decoded block will be written to.
+     * @param size the number of symbols in the block.
      */
-    static std::string decodeBitString(
-        const std::unordered_map<std::string, char> &decoding_table, std::string::const_iterator start, std::string::const_iterator end);
+    static void decodeBlock(const DecodingTable &decoding_table, const FrameHeader &frame_header, uint64_t block,
+        const unsigned char *encoded_text, uint64_t encoded_size, uint64_t start_bit, uint64_t end_bit, char *output, uint64_t size);
 
+#ifdef CONCURRENT_HUFFMAN_X86_KERNELS
     /**
-     * Retrieves the decoding table, block offsets, and padding stored in the compressed file.
+     * Decodes a block of a frame with the same code as decodeBlockPortable, compiled for CPUs that have BMI2. Its
+     * variable shifts, which every code lookup and refill makes, take a single instruction and leave the flags alone.
      *
-     * @param input_file the compressed file that the data will retrieved from.
-     * @return the decoding table, block offsets, and padding stored in the compressed file.
+     * @param decoding_table the table used to map codes to their respective symbol.
+     * @param frame_header the block index of the frame that holds the block.
+     * @param block the index of the block in the frame.
+     * @param encoded_text the packed bits of the frame.
+     * @param encoded_size the number of bytes that can be read from encoded_text.
+     * @param start_bit the position of the first bit of the block.
+     * @param end_bit the position one past the last bit of the block.
+     * @param output the location that the decoded block will be written to.
+     * @param size the number of symbols in the block.
      */
-    static HeaderData getHeaderData(std::ifstream &input_file);
+    static void decodeBlockWithBmi2(const DecodingTable &decoding_table, const FrameHeader &frame_header, uint64_t block,
+        const unsigned char *encoded_text, uint64_t encoded_size, uint64_t start_bit, uint64_t end_bit, char *output, uint64_t size);
+#endif
 
     /**
-     * Converts a string of encoded text to a bit string that can be decoded.
+     * Decodes a block of a frame, from all of its streams at once if the block is split into interleaved streams.
+     *
+     * @param decoding_table the table used to map codes to their respective symbol.
+     * @param frame_header the block index of the frame that holds the block.
+     * @param block the index of the block in the frame.
+     * @param encoded_text the packed bits of the frame.
+     * @param encoded_size the number of bytes that can be read from encoded_text.
+     * @param start_bit the position of the first bit of the block.
+     * @param end_bit the position one past the last bit of the block.
+     * @param output the location that the decoded block will be written to.
+     * @param size the number of symbols in the block.
+     */
+    static void decodeBlockPortable(const DecodingTable &decoding_table, const FrameHeader &frame_header, uint64_t block,
+        const unsigned char *encoded_text, uint64_t encoded_size, uint64_t start_bit, uint64_t end_bit, char *output, uint64_t size);
+
+    /**
+     * Decodes a block that is split into interleaved streams. The streams are decoded in the same loop, which gives the
+     * processor several independent codes to work on at any time.
+     *
+     * @param decoding_table the table used to map codes to their respective symbol.
+     * @param encoded_text the packed bits that will be decoded.
+     * @param encoded_size the number of bytes that can be read from encoded_text.
+     * @param stream_starts the position of the first bit of each stream, followed by the position one past the last bit of
+     *                      the block.
+     * @param output the location that the decoded block will be written to.
+     * @param size the number of symbols in the block.
+     */
+    static void decodeStreams(const DecodingTable &decoding_table, const unsigned char *encoded_text, uint64_t encoded_size,
+        const std::array<uint64_t, Format::interleaved_streams + 1> &stream_starts, char *output, uint64_t size);
+
+    /**
+     * Decodes the symbols that are left in a stream once the streams can no longer be decoded side by side.
+     *
+     * @param decoding_table the table used to map codes to their respective symbol.
+     * @param reader the reader of the stream.
+     * @param output the location that the decoded block is written to.
+     * @param position the index in the output of the next symbol of the stream.
+     * @param end the index in the output one past the last symbol of the stream.
+     * @param end_bit the position one past the last bit of the stream.
+     */
+    static void finishStream(
+        const DecodingTable &decoding_table, BitReader &reader, char *output, uint64_t position, uint64_t end, uint64_t end_bit);
+
+    // A segment of a block that was decoded from a guessed position, which might not be the start of a code.
+    struct SpeculativeSegment
+    {
+        // The decoded symbols and, for the first symbols, the position of the code that each of them was decoded from.
+        std::string symbols;
+        std::vector<uint64_t> code_starts;
+        // The position one past the last code that was decoded.
+        uint64_t end_bit = 0;
+        // Once the true start of the segment is known, the symbols decoded before the guess caught up with the true codes,
+        // and the index of the first guessed symbol that is correct.
+        std::string fixed_symbols;
+        size_t first_symbol = 0;
+    };
+
+    /**
+     * Decodes a block by splitting it into segments of equal length, which are decoded in parallel. Only the first
+     * segment is known to start at a code, the other segments are decoded from their first bit anyway. A Huffman code
+     * resynchronizes quickly, so the decoding of a segment soon reaches a code that the decoding of the segment before it
+     * ends at, and every symbol decoded from there on is correct. Only the symbols before that point are decoded again.
      *
      * @param pool the thread pool that will be used for task submission, require that the thread pool has already been started.
-     * @param encoded_text the text that the bit string will be created from.
-     * @return a bit string created from the encoded text.
+     * @param decoding_table the table used to map codes to their respective symbol.
+     * @param encoded_text the packed bits that will be decoded.
+     * @param encoded_size the number of bytes that can be read from encoded_text.
+     * @param start_bit the position of the first bit of the block.
+     * @param end_bit the position one past the last bit of the block.
+     * @param output the location that the decoded block will be written to.
+     * @param size the number of symbols in the block.
+     * @param num_segments the number of segments to split the block into, require that each segment is at least
+     *                     min_segment_bits long.
+     */
+    static void decodeSpeculatively(Concurrent::ThreadPool &pool, const DecodingTable &decoding_table, const unsigned char *encoded_text,
+        uint64_t encoded_size, uint64_t start_bit, uint64_t end_bit, char *output, uint64_t size, uint64_t num_segments);
+
+    /**
+     * Decodes a segment from a position that might not be the start of a code.
+     *
+     * @param decoding_table the table used to map codes to their respective symbol.
+     * @param encoded_text the packed bits that will be decoded.
+     * @param encoded_size the number of bytes that can be read from encoded_text.
+     * @param start_bit the position of the first bit of the segment.
+     * @param end_bit the position one past the last bit of the segment, the code that crosses it is decoded as well.
+     * @return the decoded segment, which holds no symbols if the guessed codes ran into bits that are not a code.
      */
-    static std::string toBitString(Concurrent::ThreadPool &pool, const std::string &encoded_text);
+    static SpeculativeSegment decodeSegment(const DecodingTable &decoding_table, const unsigned char *encoded_text, uint64_t encoded_size,
+        uint64_t start_bit, uint64_t end_bit);
 
     /**
-     * Converts a string of encoded text to a string that can be decoded.
+     * Decodes a segment from its true start until the codes meet the codes that were decoded from the guessed start.
      *
-     * @param start an iterator to a string of encoded text, the bit string will be created starting from this position.
-     * @param end an iterator to a string of encoded text, the bit string will stop being created at this position.
-     * @return a bit string created from the encoded text.
+     * @param decoding_table the table used to map codes to their respective symbol.
+     * @param encoded_text the packed bits that will be decoded.
+     * @param encoded_size the number of bytes that can be read from encoded_text.
+     * @param start_bit the position of the first code of the segment.
+     * @param end_bit the position one past the last bit of the segment.
+     * @param segment the segment that was decoded from the guessed start, its fixed symbols and first correct symbol are set.
      */
-    static std::string toBitString(std::string::const_iterator start, std::string::const_iterator end);
+    static void synchronize(const DecodingTable &decoding_table, const unsigned char *encoded_text, uint64_t encoded_size,
+        uint64_t start_bit, uint64_t end_bit, SpeculativeSegment &segment);
 
-    // The size of the string that will be submitted to the thread pool for conversion to a bit string.
-    // Note that using small numbers will result in poor performance.
-    static constexpr uint32_t bit_string_block_size = 1000;
+    // The shortest segment that a block is split into for speculative decoding. Shorter segments spend too much of their
+    // time resynchronizing.
+    static constexpr uint64_t min_segment_bits = 1 << 15;
+    // The number of codes, from the start of a speculative segment, whose positions are remembered for resynchronizing.
+    static constexpr size_t sync_window = 1024;
 };
 #endif // CONCURRENT_HUFFMAN_DECODER_H
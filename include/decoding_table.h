@@ -0,0 +1,135 @@
+#ifndef CONCURRENT_HUFFMAN_DECODING_TABLE_H
+#define CONCURRENT_HUFFMAN_DECODING_TABLE_H
+#include <stdexcept>
+#include <vector>
+#include "bit_reader.h"
+#include "code.h"
+
+/**
+ * A flat lookup table for decoding Huffman codes. The next root_bits bits of the encoded text index the root table,
+ * which resolves every code of at most root_bits bits with a single lookup. Longer codes are resolved through
+ * sub tables that are indexed by the bits that follow.
+ *
+ * When the codes are short enough that a lookup would usually cover several of them, a second table is built that is
+ * indexed by the next multi_symbol_bits bits and holds every code that fits in them, up to max_symbols_per_entry codes.
+ */
+class DecodingTable
+{
+public:
+    /**
+     * Constructs the decoding table.
+     *
+     * @param code_table a table that maps symbols to their code, require that the codes are prefix free.
+     */
+    explicit DecodingTable(const CodeTable &code_table);
+
+    /**
+     * Decodes the next symbol.
+     *
+     * @param reader the reader that the encoded text will be read from, require that the reader has been refilled.
+     * @return the decoded symbol.
+     */
+    unsigned char decodeSymbol(BitReader &reader) const
+    {
+        // Most codes are resolved by the root table. The rest are handled out of line, which keeps this small enough to be
+        // inlined into the decoding loops.
+        const Entry &entry = entries[reader.peek(root_bits)];
+        if (entry.sub_table_bits != 0 || entry.length == 0)
+            return decodeLongSymbol(reader);
+        reader.consume(entry.length);
+        return static_cast<unsigned char>(entry.value);
+    }
+
+    /**
+     * Decodes the next few symbols with a single lookup, falling back to decodeSymbol for a code that is too long.
+     *
+     * @param reader the reader that the encoded text will be read from, require that the reader has been refilled.
+     * @param output the location that the symbols will be written to, require that it has room for max_symbols_per_entry
+     *               symbols, even though fewer may be decoded.
+     * @return the number of symbols that were decoded, at least one.
+     */
+    uint32_t decodeSymbols(BitReader &reader, char *output) const
+    {
+        const MultiSymbolEntry &entry = multi_symbol_entries[reader.peek(multi_symbol_bits)];
+        if (entry.num_symbols == 0)
+        {
+            output[0] = static_cast<char>(decodeSymbol(reader));
+            return 1;
+        }
+        reader.consume(entry.length);
+        for (uint32_t i = 0; i < max_symbols_per_entry; ++i)
+            output[i] = static_cast<char>(entry.symbols[i]);
+        return entry.num_symbols;
+    }
+
+    /**
+     * @return true if the table decodes several symbols per lookup with decodeSymbols, and false if decodeSymbols would
+     *         not be any faster than decodeSymbol.
+     */
+    bool decodesSeveralSymbols() const
+    {
+        return !multi_symbol_entries.empty();
+    }
+
+    // The most symbols that decodeSymbols decodes at once.
+    static constexpr uint32_t max_symbols_per_entry = 4;
+
+private:
+    struct Entry
+    {
+        // The decoded symbol or, for an entry that links to a sub table, the index of the first entry of the sub table.
+        uint32_t value = 0;
+        // The number of bits consumed by the entry, zero if no code starts with the bits of the index.
+        uint8_t length = 0;
+        // Zero if the entry holds a symbol, otherwise the number of bits used to index the sub table.
+        uint8_t sub_table_bits = 0;
+    };
+
+    /**
+     * Decodes the next symbol when its code is longer than the root table, or when the bits are not a code.
+     *
+     * @param reader the reader that the encoded text will be read from, require that the reader has been refilled.
+     * @return the decoded symbol.
+     */
+    unsigned char decodeLongSymbol(BitReader &reader) const;
+
+    /**
+     * Fills a table with the symbols whose codes start with the bits that have already been consumed.
+     *
+     * @param code_table a table that maps symbols to their code.
+     * @param symbols the symbols that will be placed in the table.
+     * @param table_start the index of the first entry of the table.
+     * @param table_bits the number of bits used to index the table.
+     * @param consumed the number of code bits that were consumed before reaching the table.
+     */
+    void fillTable(const CodeTable &code_table, const std::vector<unsigned char> &symbols, uint32_t table_start, uint32_t table_bits,
+        uint32_t consumed);
+
+    struct MultiSymbolEntry
+    {
+        // The decoded symbols, only the first num_symbols of them are valid.
+        unsigned char symbols[max_symbols_per_entry] = {};
+        // The number of symbols whose codes fit in the index, zero if the first code is longer than the index.
+        uint8_t num_symbols = 0;
+        // The number of bits consumed by the codes of the symbols.
+        uint8_t length = 0;
+    };
+
+    /**
+     * Fills the multi symbol table by decoding, for every index, the codes that fit in it one after another with the
+     * root table.
+     */
+    void fillMultiSymbolTable();
+
+    std::vector<Entry> entries;
+    uint32_t root_bits = 1;
+    std::vector<MultiSymbolEntry> multi_symbol_entries;
+
+    // The maximum number of bits used to index the root table and the sub tables.
+    static constexpr uint32_t max_root_bits = 11;
+    static constexpr uint32_t max_sub_table_bits = 8;
+    // The number of bits used to index the multi symbol table. The table is only built when the codes are expected to be
+    // at most half this long, so that a lookup decodes two symbols or more on average.
+    static constexpr uint32_t multi_symbol_bits = 12;
+};
+#endif // CONCURRENT_HUFFMAN_DECODING_TABLE_H
@@ -1,115 +1,281 @@
 #ifndef CONCURRENT_HUFFMAN_ENCODER_H
 #define CONCURRENT_HUFFMAN_ENCODER_H
 #include <string>
-#include <unordered_map>
+#include <string_view>
+#include <array>
 #include <filesystem>
-#include "node.h"
+#include <utility>
+#include <vector>
+#include "code.h"
+#include "compression_options.h"
+#include "compression_result.h"
+#include "compression_stats.h"
+#include "format.h"
 #include "thread_pool.h"
 
+// Maps every byte value to the number of times it occurs in the unencoded text.
+using CharacterFrequencies = std::array<uint64_t, 256>;
+
 class Encoder
 {
+    // Lets the tests check the code lengths that the encoder builds.
+    friend class EncoderTest;
+
 public:
     /**
      * Compresses the provided file. Creates a new file and does not modify the original file.
      *
+     * @param pool the thread pool that will be used for task submission, require that the thread pool has already been started
+     *             and that this is not called from a task of the pool, unless the file fits in a single block.
      * @param file_to_compress the name of the file that will be compressed, require that the file
      *                         exists and is not already compressed.
      * @param compressed_file the name of the compressed file that will be created.
-     * @param num_threads the number of threads that will be used during file compression, require that num_threads is positive.
+     * @param options the settings used to compress the file.
+     * @param stats the statistics of the call are written here if it is not a null pointer.
+     */
+    static void compressFile(Concurrent::ThreadPool &pool, const std::string &file_to_compress, const std::string &compressed_file,
+        const CompressionOptions &options, CompressionStats *stats = nullptr);
+
+    /**
+     * Compresses text that is held in memory.
+     *
+     * @param pool the thread pool that will be used for task submission, require that the thread pool has already been started.
+     * @param unencoded_text the text that will be compressed.
+     * @param compressed the buffer that the compressed text will be written to, its contents are replaced.
+     * @param options the settings used to compress the text.
+     * @param stats the statistics of the call are written here if it is not a null pointer.
+     */
+    static void compress(Concurrent::ThreadPool &pool, std::string_view unencoded_text, std::string &compressed,
+        const CompressionOptions &options, CompressionStats *stats = nullptr);
+
+    /**
+     * Compresses many files on one thread pool. A file that fits in a single block is compressed by a single task, so
+     * that small files are compressed side by side. Larger files are compressed one at a time by this thread, with
+     * their blocks spread over the pool, while the tasks of the small files fill in the gaps between their stages.
+     * A file that cannot be compressed does not stop the rest of the batch.
+     *
+     * @param pool the thread pool that will be used for task submission, require that the thread pool has already been started.
+     * @param files pairs of the name of a file that will be compressed and the name of the compressed file that will be created.
+     * @param options the settings used to compress every file.
+     * @return the result of compressing each file, in the same order as the files.
      */
-    static void compressFile(const std::string &file_to_compress, const std::string &compressed_file, uint32_t num_threads);
+    static std::vector<CompressionResult> compressFiles(
+        Concurrent::ThreadPool &pool, const std::vector<std::pair<std::string, std::string>> &files, const CompressionOptions &options);
 
 private:
     /**
-     * Creates a hash table that maps symbols to their code (a bit string).
+     * Checks that the settings can be used to compress a file.
+     *
+     * @param options the settings used to compress the file.
+     */
+    static void validateOptions(const CompressionOptions &options);
+
+    /**
+     * Compresses a file one frame at a time so that no more than the memory limit is used. Reading, encoding, and
+     * writing run side by side, with a frame in each stage.
+     *
+     * @param pool the thread pool that will be used for task submission, require that the thread pool has already been started.
+     * @param file_to_compress the name of the file that will be compressed.
+     * @param compressed_file the name of the compressed file that will be created.
+     * @param options the settings used to compress the file, require that the memory limit is positive.
+     * @param stats the statistics of the call, which the time of each stage is added to, or a null pointer.
+     */
+    static void compressFrames(Concurrent::ThreadPool &pool, const std::string &file_to_compress, const std::string &compressed_file,
+        const CompressionOptions &options, CompressionStats *stats);
+
+    /**
+     * Chooses the code lengths and block size of a compressed file.
+     *
+     * @param character_frequencies the number of times each character occurs in the unencoded text.
+     * @param options the settings used to compress the file.
+     * @return the header of the compressed file.
+     */
+    static HeaderData constructHeaderData(const CharacterFrequencies &character_frequencies, const CompressionOptions &options);
+
+    /**
+     * Finds the size of the largest frame that can be encoded without exceeding the memory limit.
+     *
+     * @param options the settings used to compress the file, require that the memory limit is at least the memory of a block.
+     * @return the number of unencoded bytes in each frame, a whole number of blocks.
+     */
+    static uint64_t maxFrameSize(const CompressionOptions &options);
+
+    /**
+     * @param options the settings used to compress the file.
+     * @return the most memory, in bytes, that each block of a frame takes up while the frame is compressed.
+     */
+    static uint64_t blockMemory(const CompressionOptions &options);
+
+    /**
+     * Checks that a file can be compressed on the calling thread. A file is only compressed from a task of the pool when
+     * it fits in a single block, since then no tasks are submitted and the task never waits on the pool.
+     *
+     * @param pool the thread pool that the file is compressed with.
+     * @param file_size the number of bytes in the file.
+     */
+    static void checkWorkerFileSize(const Concurrent::ThreadPool &pool, uint64_t file_size);
+
+    /**
+     * Compresses one file of a batch and records the outcome instead of throwing.
+     *
+     * @param pool the thread pool that will be used for task submission, require that the thread pool has already been started.
+     * @param file_to_compress the name of the file that will be compressed.
+     * @param compressed_file the name of the compressed file that will be created.
+     * @param options the settings used to compress the file.
+     * @return the sizes of the file before and after compression, or the exception that was thrown.
+     */
+    static CompressionResult compressBatchFile(Concurrent::ThreadPool &pool, const std::string &file_to_compress,
+        const std::string &compressed_file, const CompressionOptions &options);
+
+    /**
+     * Finds the code lengths of the Huffman code of some text, limited to a maximum length.
+     *
+     * @param character_frequencies the number of times each character occurs in the text.
+     * @param max_code_length the longest code that may be assigned.
+     * @return the length of the code of each symbol, symbols that are not in the text have a length of zero.
+     */
+    static CodeLengths constructCodeLengths(const CharacterFrequencies &character_frequencies, uint8_t max_code_length);
+
+    /**
+     * Finds the optimal code lengths that do not exceed a maximum length using the package-merge algorithm.
      *
-     * @param huffman_tree_root the root of the huffman tree, require that the huffman_tree_root is not a null pointer.
-     * @return a hash table that maps symbols to their code.
+     * @param character_frequencies the number of times each character occurs in the unencoded text.
+     * @param max_code_length the longest code that may be assigned, require that 2^max_code_length is at least the number of
+     *                        characters.
+     * @return the length of the code of each symbol, symbols that are not in the text have a length of zero.
      */
-    static std::unordered_map<char, std::string> constructHuffmanTable(std::unique_ptr<Node> huffman_tree_root);
+    static CodeLengths constructLimitedCodeLengths(const CharacterFrequencies &character_frequencies, uint8_t max_code_length);
 
     /**
-     * Constructs a new Huffman tree.
+     * Finds the code lengths of the Huffman code of some text. The lengths are computed in place in a sorted array of the
+     * frequencies, in time linear in the number of characters after sorting, and no tree is built.
      *
-     * @param character_frequencies a hashmap that maps characters to their frequency in the unencoded text.
-     * @return
+     * @param character_frequencies the number of times each character occurs in the unencoded text, require that at least
+     *                              one character occurs.
+     * @return the length of the code of each symbol, symbols that are not in the text have a length of zero.
      */
-    static std::unique_ptr<Node> constructHuffmanTree(const std::unordered_map<char, uint64_t> &character_frequencies);
+    static CodeLengths constructHuffmanCodeLengths(const CharacterFrequencies &character_frequencies);
 
     /**
-     * Given a string of unencoded text, counts the number of times each character occurs in the text.
+     * Given a string of unencoded text, counts the number of times each character occurs in the text. Every thread
+     * counts one large contiguous range of the text.
      *
      * @param pool the thread pool that will be used for task submission, require that the thread pool has already been started.
      * @param unencoded_text the unencoded text that characters will be counted from.
-     * @return a hashmap that maps a character to the number of times it occurred in the provided text.
+     * @return the number of times each character occurs in the provided text.
      */
-    static std::unordered_map<char, uint64_t> countCharacterFrequencies(Concurrent::ThreadPool &pool, const std::string &unencoded_text);
+    static CharacterFrequencies countCharacterFrequencies(Concurrent::ThreadPool &pool, std::string_view unencoded_text);
 
     /**
-     * Counts the number of times each character occurs in unencoded text.
+     * Counts the number of times each character occurs in a range of unencoded text.
      *
-     * @param start an iterator to a string of unencoded text, characters will be counted starting from this position.
-     * @param end an iterator to a string of unencoded text, characters will be not be counted from this position onwards.
-     * @return a hashmap that maps characters to the number of times that they appeared in the unencoded text.
+     * @param unencoded_text the unencoded text that characters will be counted from.
+     * @return the number of times each character occurs in the provided text.
+     */
+    static CharacterFrequencies countCharacterFrequencies(std::string_view unencoded_text);
+
+    /**
+     * Adds character counts to a running total. The loop has no dependencies between iterations, so it is vectorized.
+     *
+     * @param total the counts that will be added to.
+     * @param counts the counts that will be added.
      */
-    static std::unordered_map<char, uint64_t> countCharacterFrequencies(std::string::const_iterator start, std::string::const_iterator end);
+    static void addCharacterFrequencies(CharacterFrequencies &total, const CharacterFrequencies &counts);
 
     /**
-     * Converts a string of unencoded text to a string of ones and zeros that is the encoded text.
+     * Builds the block index of a frame. Finds the exact number of bits that every block, and every stream of a block,
+     * of the text will be encoded with, so that each block can be written straight to its final place in the output, the
+     * checksum of every block, and the code tables of the frame.
      *
      * @param pool the thread pool that will be used for task submission, require that the thread pool has already been started.
-     * @param encoding_table a hashmap that maps symbols to their respective code value.
-     * @param unencoded_text the unencoded text that the bit string will be created from.
-     * @return a string of ones and zeros that is the encoded text.
+     * @param header_data the header of the compressed file.
+     * @param unencoded_text the unencoded text of the frame.
+     * @param options the settings used to compress the file.
+     * @return the block index of the frame.
      */
-    static std::pair<std::string, std::vector<uint32_t>> toBitString(
-        Concurrent::ThreadPool &pool, const std::unordered_map<char, std::string> &encoding_table, const std::string &unencoded_text);
+    static FrameHeader constructFrameHeader(
+        Concurrent::ThreadPool &pool, const HeaderData &header_data, std::string_view unencoded_text, const CompressionOptions &options);
 
     /**
-     * Converts a string of unencoded text to a string of ones and zeros that is the encoded text.
+     * Chooses the code table of every group of blocks of a frame. The best table of each group is built in parallel.
      *
-     * @param encoding_table a hashmap that maps symbols to their respective code value.
-     * @param start an iterator to a string of unencoded text, characters will be converted to their code starting from this position.
-     * @param end an iterator to a string of unencoded text, characters will not be converted to their code from this position onwards.
-     * @return a string of ones and zeros that is the encoded text.
+     * @param pool the thread pool that will be used for task submission, require that the thread pool has already been started.
+     * @param code_lengths the code lengths in the header of the file, require that they can encode every block.
+     * @param stream_frequencies the number of times each character occurs in each stream of each block of the frame,
+     *                           require that there is at least one block.
+     * @param num_streams the number of streams that each block is split into.
+     * @param options the settings used to compress the file, require that the number of blocks per table is positive.
+     * @param frame_header the block index of the frame, the code tables and the table of each block are set.
      */
-    static std::string toBitString(
-        const std::unordered_map<char, std::string> &encoding_table, std::string::const_iterator start, std::string::const_iterator end);
+    static void constructFrameTables(Concurrent::ThreadPool &pool, const CodeLengths &code_lengths,
+        const std::vector<CharacterFrequencies> &stream_frequencies, uint32_t num_streams, const CompressionOptions &options,
+        FrameHeader &frame_header);
 
     /**
-     * Given a bit string, appends the minimum number of zeros to the string such that it has
-     * a size that is divisible by eight.
+     * @param code_lengths the length of the code of each symbol.
+     * @param character_frequencies the number of times each character occurs in some text.
+     * @return the number of bits that the text is encoded with.
+     */
+    static uint64_t encodedBits(const CodeLengths &code_lengths, const CharacterFrequencies &character_frequencies);
+
+    /**
+     * @param code_lengths the length of the code of each symbol.
+     * @param character_frequencies the number of times each character occurs in some text.
+     * @return true if every character of the text has a code and false otherwise.
+     */
+    static bool canEncode(const CodeLengths &code_lengths, const CharacterFrequencies &character_frequencies);
+
+    /**
+     * Builds the codes that the blocks of a frame are encoded with.
      *
-     * @param bit_string a string of ones and zeros that will be padded with zeros (if necessary).
-     * @return the number of zeros that the bit string was padded with.
+     * @param header_data the header of the compressed file.
+     * @param frame_header the block index of the frame.
+     * @return the code table of the file followed by the code tables of the frame.
      */
-    static uint8_t padBitString(std::string &bit_string);
+    static std::vector<CodeTable> constructCodeTables(const HeaderData &header_data, const FrameHeader &frame_header);
 
     /**
-     * Converts a bit string to bytes.
+     * Encodes a string of unencoded text one block at a time. The blocks are written back to back, without any padding
+     * between them, and every block is written straight to its place in the output.
      *
      * @param pool the thread pool that will be used for task submission, require that the thread pool has already been started.
-     * @param bit_string the bit string that the bytes will be created from, require that bit_string has a size that is divisible
-     *                   by eight.
-     * @return a vector containing the bytes created from the bit string.
+     * @param code_tables the code table of the file followed by the code tables of the frame.
+     * @param unencoded_text the unencoded text that will be encoded.
+     * @param frame_header the block index of the frame, which gives the number of encoded bits and the table of each block.
+     * @param output the location that the blocks will be written to, require that it has room for the encoded size of the
+     *               blocks.
      */
-    static std::vector<unsigned char> toBytes(Concurrent::ThreadPool &pool, const std::string &bit_string);
+    static void encode(Concurrent::ThreadPool &pool, const std::vector<CodeTable> &code_tables, std::string_view unencoded_text,
+        const FrameHeader &frame_header, unsigned char *output);
 
     /**
-     * Convert a bit string to bytes, require that the distance between start and end is divisible by eight.
+     * Encodes a block of unencoded text starting at a bit offset. The final byte of the block is not written when the
+     * block ends part way through it, since that byte is shared with the block after it. On CPUs that have BMI2, runs
+     * the same code compiled for BMI2.
      *
-     * @param start an iterator to a bit string, the bit string will be converted to bytes starting from this position.
-     * @param end an iterator to a bit string, the bit string will not be converted to bytes from this position onward.
-     * @return a vector containing the bytes created from the bit string.
+     * @param code_table a table that maps symbols to their respective code.
+     * @param block the unencoded text of the block.
+     * @param output the location that the blocks are written to.
+     * @param bit_offset the position in output of the first bit of the block.
+     * @return the bits of the block that belong in its final byte if that byte is shared, and zero otherwise.
+     */
+    static unsigned char encode(const CodeTable &code_table, std::string_view block, unsigned char *output, uint64_t bit_offset);
+
+    /**
+     * @param block_bits the number of encoded bits in each block of a frame.
+     * @return the number of bytes needed to write the blocks back to back.
      */
-    static std::vector<unsigned char> toBytes(std::string::const_iterator start, std::string::const_iterator end);
+    static uint64_t encodedSize(const std::vector<uint32_t> &block_bits);
 
-    // The size of the string that that will be submitted to the thread pool for character counting.
-    // Note that using small numbers will result in poor performance.
-    static constexpr uint32_t count_character_block_size = 1000;
-    // The size of the bit string that will be submitted to the thread pool for conversion to bytes.
-    // Must be divisible by eight since the string is being converted to bytes.
-    // As before, using small numbers will result in poor performance.
-    static constexpr uint32_t to_bytes_block_size = 800;
+    // The smallest range of text that will be submitted to the thread pool for character counting. Smaller texts are
+    // counted by fewer threads, since starting a task costs more than counting a few kilobytes.
+    static constexpr uint32_t count_character_block_size = 1 << 16;
+    // The size of the string that will be submitted to the thread pool for encoding, which is also the unit that the
+    // decoder splits the work up by. A block this size takes long enough to encode or decode that the cost of its task
+    // hardly shows, while its text and counts still fit in the cache of a single core.
+    static constexpr uint32_t encode_block_size = 1 << 16;
+    // The share of the bits of a group of blocks, in percent, that a table of its own must save for the group to get one.
+    // Below that, the smaller output is not worth building and storing another table.
+    static constexpr uint64_t min_table_gain_percent = 1;
 };
 #endif // CONCURRENT_HUFFMAN_ENCODER_H
@@ -0,0 +1,153 @@
+#ifndef CONCURRENT_HUFFMAN_FORMAT_H
+#define CONCURRENT_HUFFMAN_FORMAT_H
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <vector>
+#include "code.h"
+
+// Used to store the data needed for file decompression that
+// is retrieved from the start of the compressed file.
+struct HeaderData
+{
+    CodeLengths code_lengths{};
+    // The number of unencoded bytes in every block except for the last block of a frame.
+    uint32_t block_size = 0;
+    // Whether the block index of every frame holds a checksum of each block.
+    bool has_checksums = false;
+    // Whether every frame may hold code tables of its own, which its blocks can be encoded with instead of the table above.
+    bool has_frame_tables = false;
+    // Whether every block is split into interleaved streams that can be decoded side by side.
+    bool has_interleaved_streams = false;
+};
+
+// The block index stored at the start of every frame of the compressed file.
+struct FrameHeader
+{
+    // The number of unencoded bytes in the frame.
+    uint64_t uncompressed_size = 0;
+    // The number of encoded bits in each block of the frame.
+    std::vector<uint32_t> block_bits;
+    // The CRC-32C checksum of the unencoded bytes of each block, empty if the file does not have checksums.
+    std::vector<uint32_t> block_checksums;
+    // The number of encoded bits in every stream of each block but the last stream, whose bits are what is left of the
+    // block. Empty if the file does not have interleaved streams.
+    std::vector<uint32_t> stream_bits;
+    // The code lengths of the tables that belong to the frame, and the table that each block is encoded with. Table zero
+    // is the table in the header of the file and table i is the i-th table of the frame. Both are empty if the file does
+    // not have frame tables, in which case every block is encoded with table zero.
+    std::vector<CodeLengths> code_tables;
+    std::vector<uint32_t> block_tables;
+};
+
+/**
+ * Reads and writes the binary layout of a compressed file. All integers are stored in little endian byte order.
+ *
+ *   header: magic "CHUF", version (u8), flags (u8), symbol count (u16), code lengths, block size (u32)
+ *   frame:  uncompressed size (u64), encoded bits of each block (u32 each), checksum of each block (u32 each, only if
+ *           the checksum flag is set), encoded bits of every stream of each block but the last (u32 each, only if the
+ *           interleaved streams flag is set), frame tables (only if the frame tables flag is set), encoded data padded
+ *           to a whole byte
+ *   frame tables: table count (u32), symbol count (u16) and code lengths of each table, table of each block (u32 each)
+ *
+ * A block with interleaved streams is split into interleaved_streams runs of symbols of equal length, apart from the
+ * last runs, and each run is a stream. The streams of a block are stored back to back, so the encoded block is the same
+ * with or without the streams; the stream lengths only tell a decoder where each of them starts.
+ *
+ * The code lengths are stored as (symbol, length) byte pairs when there are fewer than 128 symbols and as 256 lengths
+ * otherwise, so the table never takes more than 256 bytes. The file holds any number of frames after the header.
+ */
+struct Format
+{
+    /**
+     * Writes the header of a compressed file.
+     *
+     * @param output the stream that the header will be written to.
+     * @param header_data the code lengths, block size, and features of the file that will be written.
+     */
+    static void writeHeader(std::ostream &output, const HeaderData &header_data);
+
+    /**
+     * Reads the header of a compressed file.
+     *
+     * @param input the stream that the header will be read from, the stream must be positioned at the start of the file.
+     * @return the code lengths and block size of the compressed file.
+     */
+    static HeaderData readHeader(std::istream &input);
+
+    /**
+     * Writes the block index of a frame.
+     *
+     * @param output the stream that the block index will be written to.
+     * @param header_data the header of the compressed file.
+     * @param frame_header the uncompressed size and encoded bits of each block of the frame.
+     */
+    static void writeFrameHeader(std::ostream &output, const HeaderData &header_data, const FrameHeader &frame_header);
+
+    /**
+     * Reads the block index of a frame.
+     *
+     * @param input the stream that the block index will be read from, the stream must be positioned at the start of a frame.
+     * @param header_data the header of the compressed file.
+     * @return the uncompressed size and encoded bits of each block of the frame.
+     */
+    static FrameHeader readFrameHeader(std::istream &input, const HeaderData &header_data);
+
+    /**
+     * @param uncompressed_size the number of unencoded bytes in a frame.
+     * @param block_size the number of unencoded bytes in a block, require that block_size is positive.
+     * @return the number of blocks that the frame is split into.
+     */
+    static uint64_t numberOfBlocks(uint64_t uncompressed_size, uint32_t block_size)
+    {
+        return (uncompressed_size + block_size - 1) / block_size;
+    }
+
+    /**
+     * @param frame_header the block index of a frame.
+     * @param block the index of a block in the frame.
+     * @return the table that the block is encoded with, zero for the table in the header of the file.
+     */
+    static uint32_t blockTable(const FrameHeader &frame_header, uint64_t block)
+    {
+        return frame_header.block_tables.empty() ? 0 : frame_header.block_tables[block];
+    }
+
+    /**
+     * @param block_size the number of unencoded bytes in a block.
+     * @param num_streams the number of streams that the block is split into.
+     * @return the number of unencoded bytes in every stream of the block, the last streams may be shorter.
+     */
+    static uint64_t streamSize(uint64_t block_size, uint32_t num_streams)
+    {
+        return (block_size + num_streams - 1) / num_streams;
+    }
+
+    /**
+     * @param header_data the header of a compressed file.
+     * @return the number of streams that each block of the file is split into.
+     */
+    static uint32_t numberOfStreams(const HeaderData &header_data)
+    {
+        return header_data.has_interleaved_streams ? interleaved_streams : 1;
+    }
+
+    /**
+     * @param code_lengths the length of the code of each symbol.
+     * @return the number of bytes that the code lengths take up when they are written to a compressed file.
+     */
+    static uint64_t codeLengthsSize(const CodeLengths &code_lengths);
+
+    // The bytes that every compressed file starts with.
+    static constexpr char magic[4] = {'C', 'H', 'U', 'F'};
+    // The version of the layout, incremented whenever the layout changes.
+    static constexpr uint8_t version = 1;
+    // The bits of the flags byte. A reader rejects files with flags that it does not know.
+    static constexpr uint8_t checksum_flag = 1;
+    static constexpr uint8_t frame_tables_flag = 2;
+    static constexpr uint8_t interleaved_streams_flag = 4;
+    static constexpr uint8_t known_flags = checksum_flag | frame_tables_flag | interleaved_streams_flag;
+    // The number of streams that each block is split into when the interleaved streams flag is set.
+    static constexpr uint32_t interleaved_streams = 4;
+};
+#endif // CONCURRENT_HUFFMAN_FORMAT_H
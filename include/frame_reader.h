@@ -0,0 +1,67 @@
+#ifndef CONCURRENT_HUFFMAN_FRAME_READER_H
+#define CONCURRENT_HUFFMAN_FRAME_READER_H
+#include <cstdint>
+#include <exception>
+#include <string>
+#include <thread>
+#include "bounded_queue.h"
+
+/**
+ * Reads a file one frame at a time on a thread of its own, so that the next frame is read from disk while the current
+ * frame is being worked on. Frames are read with pread into a fixed number of buffers that are handed back and forth, so
+ * the reader never holds more than one frame that has not been asked for yet.
+ */
+class FrameReader
+{
+public:
+    /**
+     * Opens a file and starts reading its first frame.
+     *
+     * @param file_name_ the name of the file that will be read.
+     * @param frame_size_ the number of bytes in every frame but the last, require that it is positive.
+     */
+    FrameReader(const std::string &file_name_, uint64_t frame_size_);
+
+    FrameReader(const FrameReader &) = delete;
+    FrameReader &operator=(const FrameReader &) = delete;
+
+    /**
+     * Stops reading, even if frames are left, and closes the file.
+     */
+    ~FrameReader();
+
+    /**
+     * Waits for the next frame of the file.
+     *
+     * @param frame the buffer that the frame will be moved to. Its previous contents are given back to the reader so that
+     *              its memory is used for a later frame.
+     * @return true if a frame was read and false if the end of the file has been reached.
+     */
+    bool next(std::string &frame);
+
+private:
+    /**
+     * Fills free buffers with the frames of the file, in order, until the end of the file or until the reader is stopped.
+     */
+    void readFrames();
+
+    /**
+     * Reads the frame that starts at the current offset into a buffer.
+     *
+     * @param frame the buffer that the frame will be read into.
+     */
+    void readFrame(std::string &frame);
+
+    std::string file_name;
+    int descriptor = -1;
+    uint64_t frame_size;
+    uint64_t offset = 0;
+    // Buffers that are waiting to be filled and frames that are waiting to be used. One buffer starts out free, and the
+    // other is the one that is handed in by the first call to next.
+    Concurrent::BoundedQueue<std::string> free_frames{2};
+    Concurrent::BoundedQueue<std::string> read_frames{2};
+    // The reason that reading stopped early, which is rethrown by next.
+    std::exception_ptr error;
+    std::thread thread;
+};
+#endif // CONCURRENT_HUFFMAN_FRAME_READER_H
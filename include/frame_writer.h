@@ -0,0 +1,67 @@
+#ifndef CONCURRENT_HUFFMAN_FRAME_WRITER_H
+#define CONCURRENT_HUFFMAN_FRAME_WRITER_H
+#include <exception>
+#include <string>
+#include <thread>
+#include "bounded_queue.h"
+
+/**
+ * Writes a file one piece at a time on a thread of its own, so that a piece is written to disk while the next one is
+ * being built. Pieces are written in the order that they are handed in. The buffers are handed back and forth, so that no
+ * more than one piece is waiting to be written at any time.
+ */
+class FrameWriter
+{
+public:
+    /**
+     * Creates a file, replacing any existing file.
+     *
+     * @param file_name_ the name of the file that will be created.
+     */
+    explicit FrameWriter(const std::string &file_name_);
+
+    FrameWriter(const FrameWriter &) = delete;
+    FrameWriter &operator=(const FrameWriter &) = delete;
+
+    /**
+     * Stops writing, even if pieces are left, and closes the file.
+     */
+    ~FrameWriter();
+
+    /**
+     * Hands a piece of the file to the writer, waiting if the piece before it has not been written yet.
+     *
+     * @param frame the bytes that will be written next. It is replaced with an empty buffer whose memory can be reused
+     *              for the next piece.
+     */
+    void write(std::string &frame);
+
+    /**
+     * Waits for every piece to be written and closes the file. Require that no pieces are written afterwards.
+     */
+    void finish();
+
+private:
+    /**
+     * Writes pieces, in order, until the writer is finished or an error occurs.
+     */
+    void writeFrames();
+
+    /**
+     * Writes every byte of a piece to the end of the file.
+     *
+     * @param frame the bytes that will be written.
+     */
+    void writeFrame(const std::string &frame);
+
+    std::string file_name;
+    int descriptor = -1;
+    // Buffers whose bytes have been written and pieces that are waiting to be written. One buffer starts out free, and
+    // the other is the one that is handed in by the first call to write.
+    Concurrent::BoundedQueue<std::string> free_frames{2};
+    Concurrent::BoundedQueue<std::string> written_frames{2};
+    // The reason that writing stopped early, which is rethrown by write and finish.
+    std::exception_ptr error;
+    std::thread thread;
+};
+#endif // CONCURRENT_HUFFMAN_FRAME_WRITER_H
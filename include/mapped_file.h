@@ -0,0 +1,61 @@
+#ifndef CONCURRENT_HUFFMAN_MAPPED_FILE_H
+#define CONCURRENT_HUFFMAN_MAPPED_FILE_H
+#include <cstdint>
+#include <string>
+
+/**
+ * A file that is memory mapped so that its contents can be read or written in place by many threads without copying
+ * them through a stream.
+ */
+class MappedFile
+{
+public:
+    /**
+     * Maps an existing file for reading.
+     *
+     * @param file_name the name of the file that will be mapped, require that the file exists.
+     */
+    explicit MappedFile(const std::string &file_name);
+
+    /**
+     * Creates a file of the given size, replacing any existing file, and maps it for writing.
+     *
+     * @param file_name the name of the file that will be created.
+     * @param size_ the size of the file in bytes.
+     */
+    MappedFile(const std::string &file_name, uint64_t size_);
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    ~MappedFile();
+
+    unsigned char *data()
+    {
+        return address;
+    }
+
+    const unsigned char *data() const
+    {
+        return address;
+    }
+
+    uint64_t size() const
+    {
+        return length;
+    }
+
+private:
+    /**
+     * Maps the open file into memory.
+     *
+     * @param file_name the name of the file, used to report errors.
+     * @param writable true if the mapping will be written to.
+     */
+    void map(const std::string &file_name, bool writable);
+
+    int descriptor = -1;
+    unsigned char *address = nullptr;
+    uint64_t length = 0;
+};
+#endif // CONCURRENT_HUFFMAN_MAPPED_FILE_H
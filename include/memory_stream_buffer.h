@@ -0,0 +1,44 @@
+#ifndef CONCURRENT_HUFFMAN_MEMORY_STREAM_BUFFER_H
+#define CONCURRENT_HUFFMAN_MEMORY_STREAM_BUFFER_H
+#include <streambuf>
+
+/**
+ * A read only stream buffer over memory that is owned elsewhere, allowing an std::istream to read bytes in place.
+ */
+class MemoryStreamBuffer : public std::streambuf
+{
+public:
+    /**
+     * A constructor for the stream buffer.
+     *
+     * @param data the bytes that will be read, require that they outlive the stream buffer.
+     * @param size the number of bytes that will be read.
+     */
+    MemoryStreamBuffer(const unsigned char *data, size_t size)
+    {
+        char *begin = const_cast<char *>(reinterpret_cast<const char *>(data));
+        setg(begin, begin, begin + size);
+    }
+
+protected:
+    pos_type seekoff(off_type offset, std::ios_base::seekdir direction, std::ios_base::openmode which) override
+    {
+        if ((which & std::ios_base::in) == 0)
+            return pos_type(off_type(-1));
+        off_type position = offset;
+        if (direction == std::ios_base::cur)
+            position += gptr() - eback();
+        else if (direction == std::ios_base::end)
+            position += egptr() - eback();
+        if (position < 0 || position > egptr() - eback())
+            return pos_type(off_type(-1));
+        setg(eback(), eback() + position, egptr());
+        return pos_type(position);
+    }
+
+    pos_type seekpos(pos_type position, std::ios_base::openmode which) override
+    {
+        return seekoff(off_type(position), std::ios_base::beg, which);
+    }
+};
+#endif // CONCURRENT_HUFFMAN_MEMORY_STREAM_BUFFER_H
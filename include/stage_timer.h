@@ -0,0 +1,59 @@
+#ifndef CONCURRENT_HUFFMAN_STAGE_TIMER_H
+#define CONCURRENT_HUFFMAN_STAGE_TIMER_H
+#include <chrono>
+#include <ctime>
+#include "compression_stats.h"
+
+/**
+ * Adds the wall and processor time between its construction and when it is stopped to a stage of the statistics of a
+ * call. A call that was not asked for statistics passes a null pointer, and the timer then reads no clocks at all, so
+ * timing a stage costs a single branch.
+ */
+class StageTimer
+{
+public:
+    /**
+     * Starts timing a stage.
+     *
+     * @param stats_ the statistics of the call, or a null pointer if the call is not collecting statistics.
+     * @param stage_ the stage that the time will be added to.
+     */
+    StageTimer(CompressionStats *stats_, StageTime CompressionStats::*stage_)
+        : stats(stats_)
+        , stage(stage_)
+    {
+        if (stats == nullptr)
+            return;
+        wall_start = std::chrono::steady_clock::now();
+        cpu_start = std::clock();
+    }
+
+    StageTimer(const StageTimer &) = delete;
+    StageTimer &operator=(const StageTimer &) = delete;
+
+    ~StageTimer()
+    {
+        stop();
+    }
+
+    /**
+     * Adds the time since the timer was started to the stage. Does nothing if the timer was already stopped.
+     */
+    void stop()
+    {
+        if (stats == nullptr)
+            return;
+        StageTime &stage_time = stats->*stage;
+        stage_time.wall_time += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - wall_start);
+        stage_time.cpu_time +=
+            std::chrono::nanoseconds(static_cast<int64_t>(static_cast<double>(std::clock() - cpu_start) * 1e9 / CLOCKS_PER_SEC));
+        stats = nullptr;
+    }
+
+private:
+    CompressionStats *stats;
+    StageTime CompressionStats::*stage;
+    std::chrono::steady_clock::time_point wall_start;
+    std::clock_t cpu_start = 0;
+};
+#endif // CONCURRENT_HUFFMAN_STAGE_TIMER_H
@@ -0,0 +1,50 @@
+#include "code.h"
+
+CodeTable CanonicalCode::fromLengths(const CodeLengths &code_lengths)
+{
+    CodeTable code_table;
+    uint64_t next_code = 0;
+    uint32_t previous_length = 0;
+    for (uint32_t length = 1; length <= max_code_length; ++length)
+    {
+        for (uint32_t symbol = 0; symbol < code_lengths.size(); ++symbol)
+        {
+            if (code_lengths[symbol] != length)
+                continue;
+            next_code <<= length - previous_length;
+            previous_length = length;
+            code_table[symbol] = {next_code, static_cast<uint8_t>(length)};
+            ++next_code;
+        }
+    }
+    return code_table;
+}
+
+bool CanonicalCode::isValid(const CodeLengths &code_lengths)
+{
+    // Count the number of codes of each length.
+    std::array<uint32_t, max_code_length + 1> length_counts{};
+    uint32_t num_symbols = 0;
+    for (const uint8_t length : code_lengths)
+    {
+        if (length > max_code_length)
+            return false;
+        if (length == 0)
+            continue;
+        ++length_counts[length];
+        ++num_symbols;
+    }
+    if (num_symbols <= 1)
+        return num_symbols == 0 || length_counts[1] == 1;
+
+    // Walk down the code tree, tracking the number of nodes at each depth that have not been assigned a code.
+    int64_t available = 1;
+    for (uint32_t length = 1; length <= max_code_length; ++length)
+    {
+        available = 2 * available - length_counts[length];
+        // The code is over-subscribed, or has more free nodes than there are symbols left to fill them.
+        if (available < 0 || available > 256)
+            return false;
+    }
+    return available == 0;
+}
@@ -1,13 +1,81 @@
+#include <stdexcept>
 #include "concurrent_huffman.h"
 #include "encoder.h"
 #include "decoder.h"
 
+namespace {
+// Every call waits for the tasks that it submits, which a worker of the same pool could end up doing with no worker left
+// to run them.
+void checkPool(const Concurrent::ThreadPool &pool)
+{
+    if (pool.isWorkerThread())
+        throw std::logic_error("A call must not be made from a task that is running on the same pool.");
+}
+} // namespace
+
+Concurrent::ThreadPool &ConcurrentHuffman::defaultPool()
+{
+    // Started by the first call that asks for it and shut down when the program exits.
+    static Concurrent::ThreadPool pool(std::max(std::thread::hardware_concurrency(), 2u) - 1);
+    return pool;
+}
+
 void ConcurrentHuffman::compressFile(const std::string &file_to_compress, const std::string &compressed_file, uint32_t num_threads)
 {
-    Encoder::compressFile(file_to_compress, compressed_file, num_threads);
+    Concurrent::ThreadPool pool(num_threads);
+    Encoder::compressFile(pool, file_to_compress, compressed_file, CompressionOptions());
+}
+
+void ConcurrentHuffman::compressFile(const std::string &file_to_compress, const std::string &compressed_file, Concurrent::ThreadPool &pool,
+    const CompressionOptions &options, CompressionStats *stats)
+{
+    checkPool(pool);
+    Encoder::compressFile(pool, file_to_compress, compressed_file, options, stats);
+}
+
+std::vector<CompressionResult> ConcurrentHuffman::compressFiles(
+    const std::vector<std::pair<std::string, std::string>> &files, Concurrent::ThreadPool &pool, const CompressionOptions &options)
+{
+    checkPool(pool);
+    return Encoder::compressFiles(pool, files, options);
 }
 
 void ConcurrentHuffman::decompressFile(const std::string &file_to_decompress, const std::string &decompressed_file, uint32_t num_threads)
 {
-    Decoder::decompressFile(file_to_decompress, decompressed_file, num_threads);
+    Concurrent::ThreadPool pool(num_threads);
+    Decoder::decompressFile(pool, file_to_decompress, decompressed_file);
+}
+
+void ConcurrentHuffman::decompressFile(
+    const std::string &file_to_decompress, const std::string &decompressed_file, Concurrent::ThreadPool &pool, CompressionStats *stats)
+{
+    checkPool(pool);
+    Decoder::decompressFile(pool, file_to_decompress, decompressed_file, stats);
+}
+
+std::string ConcurrentHuffman::decompressRange(
+    const std::string &file_to_decompress, uint64_t offset, uint64_t length, Concurrent::ThreadPool &pool)
+{
+    checkPool(pool);
+    return Decoder::decompressRange(pool, file_to_decompress, offset, length);
+}
+
+void ConcurrentHuffman::verifyFile(const std::string &file_to_verify, Concurrent::ThreadPool &pool)
+{
+    checkPool(pool);
+    Decoder::verifyFile(pool, file_to_verify);
+}
+
+void ConcurrentHuffman::compress(std::string_view text, std::string &compressed, Concurrent::ThreadPool &pool,
+    const CompressionOptions &options, CompressionStats *stats)
+{
+    checkPool(pool);
+    Encoder::compress(pool, text, compressed, options, stats);
+}
+
+void ConcurrentHuffman::decompress(
+    std::string_view compressed, std::string &decompressed, Concurrent::ThreadPool &pool, CompressionStats *stats)
+{
+    checkPool(pool);
+    Decoder::decompress(pool, compressed, decompressed, stats);
 }
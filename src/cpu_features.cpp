@@ -0,0 +1,50 @@
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include "cpu_features.h"
+
+namespace {
+struct DetectedFeatures
+{
+    bool bmi2 = false;
+    bool sse42 = false;
+};
+
+const DetectedFeatures &detectedFeatures()
+{
+    static const DetectedFeatures detected_features = [] {
+        DetectedFeatures features;
+#ifdef CONCURRENT_HUFFMAN_X86_KERNELS
+        __builtin_cpu_init();
+        features.bmi2 = __builtin_cpu_supports("bmi2") != 0;
+        features.sse42 = __builtin_cpu_supports("sse4.2") != 0;
+#endif
+        return features;
+    }();
+    return detected_features;
+}
+
+std::atomic<bool> &extensionsEnabled()
+{
+    static std::atomic<bool> extensions_enabled = [] {
+        const char *const kernels = std::getenv("CONCURRENT_HUFFMAN_KERNELS");
+        return kernels == nullptr || std::strcmp(kernels, "portable") != 0;
+    }();
+    return extensions_enabled;
+}
+} // namespace
+
+bool CpuFeatures::hasBmi2()
+{
+    return detectedFeatures().bmi2 && extensionsEnabled().load(std::memory_order_relaxed);
+}
+
+bool CpuFeatures::hasSse42()
+{
+    return detectedFeatures().sse42 && extensionsEnabled().load(std::memory_order_relaxed);
+}
+
+void CpuFeatures::setExtensionsEnabled(bool enabled)
+{
+    extensionsEnabled().store(enabled, std::memory_order_relaxed);
+}
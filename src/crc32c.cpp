@@ -0,0 +1,75 @@
+#include <array>
+#include <cstring>
+#include "cpu_features.h"
+#include "crc32c.h"
+#ifdef CONCURRENT_HUFFMAN_X86_KERNELS
+#include <nmmintrin.h>
+#endif
+
+namespace {
+using CrcTables = std::array<std::array<uint32_t, 256>, 8>;
+
+constexpr CrcTables makeTables()
+{
+    // The reflected Castagnoli polynomial.
+    constexpr uint32_t polynomial = 0x82F63B78;
+    CrcTables tables{};
+    for (uint32_t byte = 0; byte < 256; ++byte)
+    {
+        uint32_t crc = byte;
+        for (uint32_t bit = 0; bit < 8; ++bit)
+            crc = (crc >> 1) ^ (crc & 1 ? polynomial : 0);
+        tables[0][byte] = crc;
+    }
+    // Table i gives the effect of a byte that is followed by i more bytes.
+    for (uint32_t table = 1; table < 8; ++table)
+    {
+        for (uint32_t byte = 0; byte < 256; ++byte)
+            tables[table][byte] = (tables[table - 1][byte] >> 8) ^ tables[0][tables[table - 1][byte] & 0xFF];
+    }
+    return tables;
+}
+
+constexpr CrcTables tables = makeTables();
+
+uint32_t computeWithTables(const unsigned char *data, size_t size)
+{
+    uint32_t crc = 0xFFFFFFFF;
+    for (; size >= 8; data += 8, size -= 8)
+    {
+        const uint32_t low = crc ^ (data[0] | data[1] << 8 | data[2] << 16 | static_cast<uint32_t>(data[3]) << 24);
+        crc = tables[7][low & 0xFF] ^ tables[6][(low >> 8) & 0xFF] ^ tables[5][(low >> 16) & 0xFF] ^ tables[4][low >> 24] ^
+              tables[3][data[4]] ^ tables[2][data[5]] ^ tables[1][data[6]] ^ tables[0][data[7]];
+    }
+    for (; size > 0; ++data, --size)
+        crc = (crc >> 8) ^ tables[0][(crc ^ *data) & 0xFF];
+    return ~crc;
+}
+
+#ifdef CONCURRENT_HUFFMAN_X86_KERNELS
+// The SSE4.2 crc32 instruction computes the same checksum, with the same bit order, eight bytes at a time.
+CONCURRENT_HUFFMAN_TARGET("sse4.2") uint32_t computeWithSse42(const unsigned char *data, size_t size)
+{
+    uint64_t crc = 0xFFFFFFFF;
+    for (; size >= 8; data += 8, size -= 8)
+    {
+        uint64_t word;
+        std::memcpy(&word, data, sizeof(word));
+        crc = _mm_crc32_u64(crc, word);
+    }
+    auto crc32 = static_cast<uint32_t>(crc);
+    for (; size > 0; ++data, --size)
+        crc32 = _mm_crc32_u8(crc32, *data);
+    return ~crc32;
+}
+#endif
+} // namespace
+
+uint32_t Crc32c::compute(const unsigned char *data, size_t size)
+{
+#ifdef CONCURRENT_HUFFMAN_X86_KERNELS
+    if (CpuFeatures::hasSse42())
+        return computeWithSse42(data, size);
+#endif
+    return computeWithTables(data, size);
+}
@@ -1,171 +1,617 @@
-#include <fstream>
-#include <iostream>
-#include <sstream>
-#include <filesystem>
-#include <bitset>
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <istream>
+#include <limits>
+#include <numeric>
+#include <stdexcept>
+#include <utility>
+#include "cpu_features.h"
+#include "crc32c.h"
 #include "decoder.h"
+#include "mapped_file.h"
+#include "memory_stream_buffer.h"
+#include "stage_timer.h"
 
-void Decoder::decompressFile(const std::string &file_to_decompress, const std::string &decompressed_file, uint32_t num_threads)
+void Decoder::decompressFile(
+    Concurrent::ThreadPool &pool, const std::string &file_to_decompress, const std::string &decompressed_file, CompressionStats *stats)
 {
-    // Start up the thread pool for decoding task submission.
-    Concurrent::ThreadPool thread_pool(num_threads);
+    if (stats != nullptr)
+        *stats = CompressionStats();
+    StageTimer total_timer(stats, &CompressionStats::total);
 
-    // Try to open the encoded file.
-    std::ifstream input_stream;
-    input_stream.exceptions(std::ifstream::failbit);
+    // Map the compressed file into memory so that every thread can read it in place.
+    StageTimer reading_timer(stats, &CompressionStats::reading);
+    const MappedFile input_file(file_to_decompress);
+    const CompressedLayout layout = readLayout(input_file.data(), input_file.size());
+    reading_timer.stop();
+
+    // Create the decompressed file at its final size and decode each frame directly into its place in the file.
+    StageTimer writing_timer(stats, &CompressionStats::writing);
+    MappedFile output_file(decompressed_file, layout.decompressed_size);
+    writing_timer.stop();
+    StageTimer decoding_timer(stats, &CompressionStats::decoding);
+    decode(pool, layout, input_file.data(), input_file.size(), reinterpret_cast<char *>(output_file.data()));
+    decoding_timer.stop();
+    recordLayout(stats, pool, layout, input_file.size());
+}
+
+void Decoder::decompress(Concurrent::ThreadPool &pool, std::string_view compressed, std::string &decompressed, CompressionStats *stats)
+{
+    if (stats != nullptr)
+        *stats = CompressionStats();
+    StageTimer total_timer(stats, &CompressionStats::total);
+
+    const auto *compressed_data = reinterpret_cast<const unsigned char *>(compressed.data());
+    StageTimer reading_timer(stats, &CompressionStats::reading);
+    const CompressedLayout layout = readLayout(compressed_data, compressed.size());
+    reading_timer.stop();
+    StageTimer writing_timer(stats, &CompressionStats::writing);
+    decompressed.resize(layout.decompressed_size);
+    writing_timer.stop();
+    StageTimer decoding_timer(stats, &CompressionStats::decoding);
+    decode(pool, layout, compressed_data, compressed.size(), decompressed.data());
+    decoding_timer.stop();
+    recordLayout(stats, pool, layout, compressed.size());
+}
+
+std::string Decoder::decompressRange(Concurrent::ThreadPool &pool, const std::string &file_to_decompress, uint64_t offset, uint64_t length)
+{
+    // Map the compressed file into memory, only the pages that hold the headers and the blocks of the range are read.
+    const MappedFile input_file(file_to_decompress);
+    const CompressedLayout layout = readLayout(input_file.data(), input_file.size());
+    if (offset > layout.decompressed_size || length > layout.decompressed_size - offset)
+        throw std::out_of_range("The range is not within the decompressed file.");
+
+    // Decode the blocks of every frame that overlaps with the range.
+    const DecodingTable file_table(CanonicalCode::fromLengths(layout.header_data.code_lengths));
+    std::vector<FrameDecodingTables> decoding_tables(layout.frames.size());
+    std::string range(length, '\0');
+    std::vector<std::future<void>> futures;
     try
     {
-        input_stream.open(file_to_decompress, std::ios::binary);
+        for (size_t i = 0; i < layout.frames.size(); ++i)
+        {
+            const FrameLayout &frame = layout.frames[i];
+            decodeRange(pool, file_table, decoding_tables[i], layout.header_data.block_size, frame, input_file.data() + frame.encoded_start,
+                input_file.size() - frame.encoded_start, offset, range.data(), length, futures);
+        }
     }
-    catch (const std::exception &e)
+    catch (...)
     {
-        std::ostringstream msg;
-        msg << "Opening file '" << decompressed_file << "' failed, it either doesn't exist or is not accessible.";
-        throw std::runtime_error(msg.str());
+        // The tasks that were submitted before the failure still write to the range and read the tables.
+        for (auto &future : futures)
+            future.wait();
+        throw;
     }
 
-    // Get decoding table, block offsets, and padding from input_stream header.
-    const HeaderData header_data = getHeaderData(input_stream);
+    // Wait for every block to be decoded before reporting a block that failed to decode.
+    for (auto &future : futures)
+        future.wait();
+    for (auto &future : futures)
+        future.get();
+    return range;
+}
 
-    // Read the rest of the input_stream into memory.
-    std::stringstream buffer;
-    buffer << input_stream.rdbuf();
-    const std::string text = buffer.str();
-    input_stream.close();
+void Decoder::verifyFile(Concurrent::ThreadPool &pool, const std::string &file_to_verify)
+{
+    const MappedFile input_file(file_to_verify);
+    const CompressedLayout layout = readLayout(input_file.data(), input_file.size());
+    const DecodingTable file_table(CanonicalCode::fromLengths(layout.header_data.code_lengths));
+    const uint32_t block_size = layout.header_data.block_size;
 
-    // Get the encoded text as a bit string and remove any padding zeros.
-    std::string bit_string = toBitString(thread_pool, text);
-    bit_string.erase(bit_string.length() - header_data.padding);
+    // Submit every block of every frame to the thread pool. Each block is decoded into a buffer that belongs to the thread
+    // that decodes it and is checked against its checksum, nothing is written out.
+    std::vector<FrameDecodingTables> decoding_tables;
+    decoding_tables.reserve(layout.frames.size());
+    std::vector<std::future<void>> futures;
+    for (const FrameLayout &frame : layout.frames)
+    {
+        decoding_tables.push_back(constructDecodingTables(file_table, frame.frame_header, 0, frame.frame_header.block_bits.size()));
+        const unsigned char *const encoded_text = input_file.data() + frame.encoded_start;
+        const uint64_t encoded_size = input_file.size() - frame.encoded_start;
+        uint64_t block_start = 0;
+        for (uint64_t i = 0; i < frame.frame_header.block_bits.size(); ++i)
+        {
+            const uint64_t block_end = block_start + frame.frame_header.block_bits[i];
+            const uint64_t size = std::min<uint64_t>(block_size, frame.frame_header.uncompressed_size - i * block_size);
+            futures.push_back(pool.submitTask(
+                [&table = blockTable(decoding_tables.back(), frame.frame_header, i), &frame, encoded_text, encoded_size, block_start,
+                    block_end, size, i] {
+                    thread_local std::vector<char> block;
+                    block.resize(size);
+                    decodeBlock(table, frame.frame_header, i, encoded_text, encoded_size, block_start, block_end, block.data(), size);
+                    verifyChecksum(frame.frame_header, i, block.data(), size);
+                }));
+            block_start = block_end;
+        }
+    }
+
+    // Wait for every block to be checked before reporting a block that failed.
+    for (auto &future : futures)
+        future.wait();
+    for (auto &future : futures)
+        future.get();
+}
+
+CompressedLayout Decoder::readLayout(const unsigned char *compressed, uint64_t compressed_size)
+{
+    MemoryStreamBuffer input_buffer(compressed, compressed_size);
+    std::istream input_stream(&input_buffer);
+
+    // Get the code lengths and block size from the header.
+    CompressedLayout layout;
+    layout.header_data = Format::readHeader(input_stream);
 
-    // Decode the encoded text from the file.
-    const std::string decoded_text = decodeBitString(thread_pool, header_data, bit_string);
+    // Find every frame, and where its encoded text is, to get the size of the decompressed text.
+    while (input_stream.peek() != std::istream::traits_type::eof())
+    {
+        FrameHeader frame_header = Format::readFrameHeader(input_stream, layout.header_data);
+        const uint64_t num_bits = std::accumulate(frame_header.block_bits.begin(), frame_header.block_bits.end(), uint64_t{0});
+        const uint64_t encoded_start = input_stream.tellg();
+        if ((num_bits + 7) / 8 > compressed_size - encoded_start || !input_stream.seekg((num_bits + 7) / 8, std::ios_base::cur))
+            throw std::runtime_error("The compressed file is truncated.");
+        // Every code is at least one bit long, so a frame cannot hold more characters than it has bits. This also keeps
+        // the decompressed size from wrapping around, since no file has anywhere near 2^64 bits.
+        if (frame_header.uncompressed_size > num_bits
+            || frame_header.uncompressed_size > std::numeric_limits<uint64_t>::max() - layout.decompressed_size)
+            throw std::runtime_error("The compressed file is corrupt.");
+        const uint64_t decoded_start = layout.decompressed_size;
+        layout.decompressed_size += frame_header.uncompressed_size;
+        layout.frames.push_back({std::move(frame_header), encoded_start, decoded_start});
+    }
+    return layout;
+}
 
-    // Write the decoded string to the specified input_stream.
-    std::ofstream output_file(decompressed_file);
-    output_file << decoded_text;
-    output_file.close();
+void Decoder::decode(Concurrent::ThreadPool &pool, const CompressedLayout &layout, const unsigned char *compressed,
+    uint64_t compressed_size, char *decoded_text)
+{
+    // Rebuild the canonical codes and decode each frame directly into its place in the decoded text.
+    const DecodingTable file_table(CanonicalCode::fromLengths(layout.header_data.code_lengths));
+    for (const FrameLayout &frame : layout.frames)
+    {
+        const FrameDecodingTables decoding_tables =
+            constructDecodingTables(file_table, frame.frame_header, 0, frame.frame_header.block_bits.size());
+        decode(pool, decoding_tables, layout.header_data.block_size, frame.frame_header, compressed + frame.encoded_start,
+            compressed_size - frame.encoded_start, decoded_text + frame.decoded_start);
+    }
 }
 
-std::string Decoder::decodeBitString(
-    const std::unordered_map<std::string, char> &decoding_table, std::string::const_iterator start, std::string::const_iterator end)
+Decoder::FrameDecodingTables Decoder::constructDecodingTables(
+    const DecodingTable &file_table, const FrameHeader &frame_header, uint64_t first_block, uint64_t end_block)
 {
-    std::string decoded_block;
-    std::string current;
-    while (start != end)
+    FrameDecodingTables decoding_tables;
+    decoding_tables.file_table = &file_table;
+    decoding_tables.frame_tables.resize(frame_header.code_tables.size());
+    for (uint64_t i = first_block; i < end_block; ++i)
     {
-        // Add characters to current until it matches a key in the decoding table.
-        current += *start;
-        if (decoding_table.find(current) != decoding_table.end())
+        const uint32_t table = Format::blockTable(frame_header, i);
+        if (table != 0 && !decoding_tables.frame_tables[table - 1])
         {
-            decoded_block += decoding_table.at(current);
-            current = "";
+            decoding_tables.frame_tables[table - 1] =
+                std::make_unique<DecodingTable>(CanonicalCode::fromLengths(frame_header.code_tables[table - 1]));
         }
-        ++start;
     }
-    return decoded_block;
+    return decoding_tables;
 }
 
-std::string Decoder::decodeBitString(Concurrent::ThreadPool &pool, const HeaderData &header_data, const std::string &bit_string)
+const DecodingTable &Decoder::blockTable(const FrameDecodingTables &decoding_tables, const FrameHeader &frame_header, uint64_t block)
 {
-    // The entirety of the encoded text, decoded.
-    std::string decoded_text;
+    const uint32_t table = Format::blockTable(frame_header, block);
+    if (table == 0)
+        return *decoding_tables.file_table;
+    assert(decoding_tables.frame_tables[table - 1] && "The table of the block has not been built!");
+    return *decoding_tables.frame_tables[table - 1];
+}
 
-    // Get the number of blocks to use.
-    const uint32_t num_blocks = header_data.block_offsets.size();
-    auto block_start = bit_string.begin();
+void Decoder::decodeRange(Concurrent::ThreadPool &pool, const DecodingTable &file_table, FrameDecodingTables &decoding_tables,
+    uint32_t block_size, const FrameLayout &frame, const unsigned char *encoded_text, uint64_t encoded_size, uint64_t offset, char *range,
+    uint64_t length, std::vector<std::future<void>> &futures)
+{
+    // Find the part of the range that the frame holds.
+    const uint64_t frame_end = frame.decoded_start + frame.frame_header.uncompressed_size;
+    const uint64_t range_start = std::max(offset, frame.decoded_start);
+    const uint64_t range_end = std::min(offset + length, frame_end);
+    if (range_start >= range_end)
+        return;
 
-    std::vector<std::future<std::string>> futures(num_blocks);
+    // Find the blocks that hold the part of the range, and where the first of them starts in the encoded text.
+    const uint64_t first_block = (range_start - frame.decoded_start) / block_size;
+    const uint64_t last_block = (range_end - frame.decoded_start - 1) / block_size;
+    const std::vector<uint32_t> &block_bits = frame.frame_header.block_bits;
+    uint64_t block_start = std::accumulate(block_bits.begin(), block_bits.begin() + first_block, uint64_t{0});
+    decoding_tables = constructDecodingTables(file_table, frame.frame_header, first_block, last_block + 1);
 
-    // Submit each block of the encoded string to the thread pool for decoding.
-    for (auto i = 0; i < num_blocks; ++i)
+    // Submit every block to the thread pool for decoding. Blocks that are entirely within the range are decoded in place,
+    // the blocks at either end of the range are decoded on the side and only their part of the range is kept.
+    for (uint64_t i = first_block; i <= last_block; ++i)
     {
-        auto block_end = block_start;
-        std::advance(block_end, header_data.block_offsets[i]);
-        futures[i] = pool.submitTask([&table = std::as_const(header_data.decoding_table), start = block_start, end = block_end] {
-            return decodeBitString(table, start, end);
-        });
+        const uint64_t block_end = block_start + block_bits[i];
+        const uint64_t block_offset = frame.decoded_start + i * block_size;
+        const uint64_t size = std::min<uint64_t>(block_size, frame_end - block_offset);
+        const uint64_t skip = range_start > block_offset ? range_start - block_offset : 0;
+        const uint64_t count = std::min(block_offset + size, range_end) - block_offset - skip;
+        char *const destination = range + (block_offset + skip - offset);
+        futures.push_back(pool.submitTask([&table = blockTable(decoding_tables, frame.frame_header, i), &frame, encoded_text, encoded_size,
+                                              block_start, block_end, size, skip, count, destination, i] {
+            if (count == size)
+            {
+                decodeBlock(table, frame.frame_header, i, encoded_text, encoded_size, block_start, block_end, destination, size);
+                verifyChecksum(frame.frame_header, i, destination, size);
+                return;
+            }
+            std::vector<char> block(size);
+            decodeBlock(table, frame.frame_header, i, encoded_text, encoded_size, block_start, block_end, block.data(), size);
+            verifyChecksum(frame.frame_header, i, block.data(), size);
+            std::copy(block.begin() + skip, block.begin() + skip + count, destination);
+        }));
         block_start = block_end;
     }
-    const auto block_end = bit_string.end();
-    const std::string last_block = decodeBitString(header_data.decoding_table, block_start, block_end);
+}
+
+void Decoder::verifyChecksum(const FrameHeader &frame_header, uint64_t block, const char *decoded_block, uint64_t size)
+{
+    if (frame_header.block_checksums.empty())
+        return;
+    if (Crc32c::compute(reinterpret_cast<const unsigned char *>(decoded_block), size) != frame_header.block_checksums[block])
+        throw std::runtime_error("The compressed file is corrupt, a block does not match its checksum.");
+}
 
-    // Combine all the decoded text into a single string.
-    for (uint32_t i = 0; i < num_blocks; ++i)
-        decoded_text += futures[i].get();
-    decoded_text += last_block;
+void Decoder::decode(const DecodingTable &decoding_table, const unsigned char *encoded_text, uint64_t encoded_size, uint64_t start_bit,
+    uint64_t end_bit, char *output, uint64_t size)
+{
+    BitReader reader(encoded_text, encoded_size, start_bit);
+    uint64_t i = 0;
+    if (decoding_table.decodesSeveralSymbols())
+    {
+        // Each lookup writes a whole entry, so stop while there is still room for one. A refill leaves enough bits for
+        // two lookups that do not fall back to decoding a single long code.
+        constexpr uint32_t max_symbols = DecodingTable::max_symbols_per_entry;
+        while (i + 2 * max_symbols <= size)
+        {
+            reader.refill();
+            i += decoding_table.decodeSymbols(reader, output + i);
+            i += decoding_table.decodeSymbols(reader, output + i);
+        }
+    }
+    for (; i < size; ++i)
+    {
+        reader.refill();
+        output[i] = static_cast<char>(decoding_table.decodeSymbol(reader));
+    }
+    if (reader.position() != end_bit)
+        throw std::runtime_error("The compressed file is corrupt.");
+}
 
-    return decoded_text;
+void Decoder::decodeBlock(const DecodingTable &decoding_table, const FrameHeader &frame_header, uint64_t block,
+    const unsigned char *encoded_text, uint64_t encoded_size, uint64_t start_bit, uint64_t end_bit, char *output, uint64_t size)
+{
+#ifdef CONCURRENT_HUFFMAN_X86_KERNELS
+    if (CpuFeatures::hasBmi2())
+    {
+        decodeBlockWithBmi2(decoding_table, frame_header, block, encoded_text, encoded_size, start_bit, end_bit, output, size);
+        return;
+    }
+#endif
+    decodeBlockPortable(decoding_table, frame_header, block, encoded_text, encoded_size, start_bit, end_bit, output, size);
 }
 
-HeaderData Decoder::getHeaderData(std::ifstream &input_file)
+#ifdef CONCURRENT_HUFFMAN_X86_KERNELS
+CONCURRENT_HUFFMAN_TARGET("bmi2")
+void Decoder::decodeBlockWithBmi2(const DecodingTable &decoding_table, const FrameHeader &frame_header, uint64_t block,
+    const unsigned char *encoded_text, uint64_t encoded_size, uint64_t start_bit, uint64_t end_bit, char *output, uint64_t size)
 {
-    std::unordered_map<std::string, char> decoding_table;
-    std::vector<uint32_t> block_offsets;
+    decodeBlockPortable(decoding_table, frame_header, block, encoded_text, encoded_size, start_bit, end_bit, output, size);
+}
+#endif
 
-    std::string header;
+void Decoder::decodeBlockPortable(const DecodingTable &decoding_table, const FrameHeader &frame_header, uint64_t block,
+    const unsigned char *encoded_text, uint64_t encoded_size, uint64_t start_bit, uint64_t end_bit, char *output, uint64_t size)
+{
+    if (frame_header.stream_bits.empty())
+    {
+        decode(decoding_table, encoded_text, encoded_size, start_bit, end_bit, output, size);
+        return;
+    }
+    const uint32_t *const stream_bits = frame_header.stream_bits.data() + block * (Format::interleaved_streams - 1);
+    std::array<uint64_t, Format::interleaved_streams + 1> stream_starts{start_bit};
+    for (uint32_t stream = 1; stream < Format::interleaved_streams; ++stream)
+        stream_starts[stream] = stream_starts[stream - 1] + stream_bits[stream - 1];
+    stream_starts.back() = end_bit;
+    decodeStreams(decoding_table, encoded_text, encoded_size, stream_starts, output, size);
+}
 
-    // Construct decoding table.
-    std::getline(input_file, header);
-    std::stringstream table_stream(header);
-    std::string code;
-    std::string symbol;
-    while (table_stream >> code && table_stream >> symbol)
-        decoding_table.insert({code, static_cast<char>(std::stoi(symbol))});
+void Decoder::decodeStreams(const DecodingTable &decoding_table, const unsigned char *encoded_text, uint64_t encoded_size,
+    const std::array<uint64_t, Format::interleaved_streams + 1> &stream_starts, char *output, uint64_t size)
+{
+    // Every stream has its own reader and its own run of the output. The readers are separate variables rather than an
+    // array so that the compiler keeps all of them in registers.
+    static_assert(Format::interleaved_streams == 4, "A reader is needed for every stream!");
+    const uint64_t stream_size = Format::streamSize(size, Format::interleaved_streams);
+    BitReader reader0(encoded_text, encoded_size, stream_starts[0]);
+    BitReader reader1(encoded_text, encoded_size, stream_starts[1]);
+    BitReader reader2(encoded_text, encoded_size, stream_starts[2]);
+    BitReader reader3(encoded_text, encoded_size, stream_starts[3]);
+    uint64_t position0 = 0;
+    uint64_t position1 = std::min(stream_size, size);
+    uint64_t position2 = std::min(2 * stream_size, size);
+    uint64_t position3 = std::min(3 * stream_size, size);
+    const uint64_t end0 = position1;
+    const uint64_t end1 = position2;
+    const uint64_t end2 = position3;
+    const uint64_t end3 = size;
 
-    // Get padding amount.
-    std::getline(input_file, header);
-    const uint8_t padding = std::stoi(header);
+    // Decode the streams side by side until one of them is nearly done. The code lengths of a stream only hold up that
+    // stream, so the lookups of the different streams overlap.
+    if (decoding_table.decodesSeveralSymbols())
+    {
+        // Each lookup writes a whole entry, so stop while there is still room in every stream for the lookups of a round.
+        constexpr uint32_t room = 2 * DecodingTable::max_symbols_per_entry;
+        while (position0 + room <= end0 && position1 + room <= end1 && position2 + room <= end2 && position3 + room <= end3)
+        {
+            reader0.refill();
+            reader1.refill();
+            reader2.refill();
+            reader3.refill();
+            position0 += decoding_table.decodeSymbols(reader0, output + position0);
+            position1 += decoding_table.decodeSymbols(reader1, output + position1);
+            position2 += decoding_table.decodeSymbols(reader2, output + position2);
+            position3 += decoding_table.decodeSymbols(reader3, output + position3);
+            position0 += decoding_table.decodeSymbols(reader0, output + position0);
+            position1 += decoding_table.decodeSymbols(reader1, output + position1);
+            position2 += decoding_table.decodeSymbols(reader2, output + position2);
+            position3 += decoding_table.decodeSymbols(reader3, output + position3);
+        }
+    }
+    else
+    {
+        // The last stream is the shortest, so every other stream still has symbols while it does.
+        while (position3 < end3)
+        {
+            reader0.refill();
+            reader1.refill();
+            reader2.refill();
+            reader3.refill();
+            output[position0++] = static_cast<char>(decoding_table.decodeSymbol(reader0));
+            output[position1++] = static_cast<char>(decoding_table.decodeSymbol(reader1));
+            output[position2++] = static_cast<char>(decoding_table.decodeSymbol(reader2));
+            output[position3++] = static_cast<char>(decoding_table.decodeSymbol(reader3));
+        }
+    }
 
-    // Get block offsets.
-    std::getline(input_file, header);
-    std::stringstream offset_stream(header);
-    std::string offset;
-    while (offset_stream >> offset)
-        block_offsets.push_back(std::stoi(offset));
+    // Finish each stream on its own, every stream must end where the next one starts.
+    finishStream(decoding_table, reader0, output, position0, end0, stream_starts[1]);
+    finishStream(decoding_table, reader1, output, position1, end1, stream_starts[2]);
+    finishStream(decoding_table, reader2, output, position2, end2, stream_starts[3]);
+    finishStream(decoding_table, reader3, output, position3, end3, stream_starts[4]);
+}
 
-    return {decoding_table, block_offsets, padding};
+void Decoder::finishStream(
+    const DecodingTable &decoding_table, BitReader &reader, char *output, uint64_t position, uint64_t end, uint64_t end_bit)
+{
+    for (; position < end; ++position)
+    {
+        reader.refill();
+        output[position] = static_cast<char>(decoding_table.decodeSymbol(reader));
+    }
+    if (reader.position() != end_bit)
+        throw std::runtime_error("The compressed file is corrupt.");
 }
 
-std::string Decoder::toBitString(Concurrent::ThreadPool &pool, const std::string &encoded_text)
+void Decoder::decode(Concurrent::ThreadPool &pool, const FrameDecodingTables &decoding_tables, uint32_t block_size,
+    const FrameHeader &frame_header, const unsigned char *encoded_text, uint64_t encoded_size, char *decoded_text)
 {
-    // The entirety of the file encoded as a bit string.
-    std::string bit_string;
+    // Get the number of blocks to use.
+    const uint64_t num_blocks = frame_header.block_bits.size();
+    if (num_blocks == 0)
+        return;
+    uint64_t block_start = 0;
 
-    const uint32_t block_size = 500;
-    const uint32_t num_blocks = encoded_text.length() / block_size;
-    auto block_start = encoded_text.begin();
-    std::vector<std::future<std::string>> futures(num_blocks);
+    // If there are fewer blocks than threads, decode the blocks one at a time and split each of them between the threads.
+    const uint64_t num_threads = pool.numberOfWorkers() + 1;
+    if (num_blocks < num_threads)
+    {
+        for (uint64_t i = 0; i < num_blocks; ++i)
+        {
+            const uint64_t block_end = block_start + frame_header.block_bits[i];
+            const uint64_t size = std::min<uint64_t>(block_size, frame_header.uncompressed_size - i * block_size);
+            const DecodingTable &decoding_table = blockTable(decoding_tables, frame_header, i);
+            const uint64_t num_segments =
+                std::min((num_threads + num_blocks - 1) / num_blocks, std::max<uint64_t>(frame_header.block_bits[i] / min_segment_bits, 1));
+            if (num_segments > 1)
+                decodeSpeculatively(pool, decoding_table, encoded_text, encoded_size, block_start, block_end, decoded_text + i * block_size,
+                    size, num_segments);
+            else
+                decodeBlock(decoding_table, frame_header, i, encoded_text, encoded_size, block_start, block_end,
+                    decoded_text + i * block_size, size);
+            verifyChecksum(frame_header, i, decoded_text + i * block_size, size);
+            block_start = block_end;
+        }
+        return;
+    }
+
+    std::vector<std::future<void>> futures(num_blocks - 1);
 
-    // Submit blocks to thread pool for conversion to bit string.
-    for (auto i = 0; i < num_blocks; ++i)
+    // Submit every block but the last to the thread pool for decoding.
+    for (uint64_t i = 0; i + 1 < num_blocks; ++i)
     {
-        auto block_end = block_start;
-        std::advance(block_end, block_size);
-        futures[i] = pool.submitTask([start = block_start, end = block_end] { return toBitString(start, end); });
+        const uint64_t block_end = block_start + frame_header.block_bits[i];
+        futures[i] = pool.submitTask([&table = blockTable(decoding_tables, frame_header, i), &frame_header, encoded_text, encoded_size,
+                                         start = block_start, end = block_end, output = decoded_text + i * block_size, block_size, i] {
+            decodeBlock(table, frame_header, i, encoded_text, encoded_size, start, end, output, block_size);
+            verifyChecksum(frame_header, i, output, block_size);
+        });
         block_start = block_end;
     }
-    const auto block_end = encoded_text.end();
-    const std::string last_encoded_block = toBitString(block_start, block_end);
+    const uint64_t block_end = block_start + frame_header.block_bits.back();
+    const uint64_t last_block_start = (num_blocks - 1) * block_size;
+    try
+    {
+        decodeBlock(blockTable(decoding_tables, frame_header, num_blocks - 1), frame_header, num_blocks - 1, encoded_text, encoded_size,
+            block_start, block_end, decoded_text + last_block_start, frame_header.uncompressed_size - last_block_start);
+        verifyChecksum(frame_header, num_blocks - 1, decoded_text + last_block_start, frame_header.uncompressed_size - last_block_start);
+    }
+    catch (...)
+    {
+        // The other blocks are still writing to the decoded text, so wait for them before giving up.
+        for (auto &future : futures)
+            future.wait();
+        throw;
+    }
+
+    // Wait for every block to be decoded before reporting a block that failed to decode.
+    for (auto &future : futures)
+        future.wait();
+    for (auto &future : futures)
+        future.get();
+}
 
-    // Combine the text that each thread encoded into a single string.
-    for (uint32_t i = 0; i < num_blocks; ++i)
+void Decoder::decodeSpeculatively(Concurrent::ThreadPool &pool, const DecodingTable &decoding_table, const unsigned char *encoded_text,
+    uint64_t encoded_size, uint64_t start_bit, uint64_t end_bit, char *output, uint64_t size, uint64_t num_segments)
+{
+    // Split the block into segments of equal length and submit every segment but the first to the thread pool.
+    const uint64_t segment_bits = (end_bit - start_bit) / num_segments;
+    std::vector<uint64_t> segment_starts(num_segments + 1);
+    for (uint64_t i = 0; i < num_segments; ++i)
+        segment_starts[i] = start_bit + i * segment_bits;
+    segment_starts.back() = end_bit;
+    std::vector<std::future<SpeculativeSegment>> futures;
+    futures.reserve(num_segments - 1);
+    uint64_t num_decoded = 0;
+    uint64_t position = start_bit;
+    try
     {
-        const std::string encoded_block = futures[i].get();
-        bit_string += encoded_block;
+        for (uint64_t i = 1; i < num_segments; ++i)
+        {
+            const uint64_t start = segment_starts[i];
+            const uint64_t end = segment_starts[i + 1];
+            futures.push_back(pool.submitTask([&table = std::as_const(decoding_table), encoded_text, encoded_size, start, end] {
+                return decodeSegment(table, encoded_text, encoded_size, start, end);
+            }));
+        }
+
+        // The first segment starts at a code, so it is decoded straight into the output.
+        BitReader reader(encoded_text, encoded_size, start_bit);
+        while (reader.position() < segment_starts[1] && num_decoded < size)
+        {
+            reader.refill();
+            output[num_decoded++] = static_cast<char>(decoding_table.decodeSymbol(reader));
+        }
+        position = reader.position();
     }
-    bit_string += last_encoded_block;
+    catch (...)
+    {
+        // The segments that were submitted still read the table and the encoded text, which the caller may free.
+        for (auto &future : futures)
+            future.wait();
+        throw;
+    }
+
+    // The decoding of each segment ends at the true start of the next segment. Walk through the segments in order, and
+    // decode each of them from its true start until its codes line up with the codes decoded from the guess. Every
+    // segment is waited for before a segment that failed to decode is reported.
+    for (auto &future : futures)
+        future.wait();
+    std::vector<SpeculativeSegment> segments;
+    segments.reserve(num_segments - 1);
+    for (auto &future : futures)
+        segments.push_back(future.get());
+    std::vector<uint64_t> output_offsets(num_segments - 1);
+    for (uint64_t i = 0; i + 1 < num_segments; ++i)
+    {
+        SpeculativeSegment &segment = segments[i];
+        synchronize(decoding_table, encoded_text, encoded_size, position, segment_starts[i + 2], segment);
+        output_offsets[i] = num_decoded;
+        num_decoded += segment.fixed_symbols.size() + segment.symbols.size() - segment.first_symbol;
+        position = segment.end_bit;
+    }
+    if (position != end_bit || num_decoded != size)
+        throw std::runtime_error("The compressed file is corrupt.");
+
+    // Copy the symbols of every segment to their place in the output.
+    std::vector<std::future<void>> copies;
+    copies.reserve(num_segments - 1);
+    try
+    {
+        for (uint64_t i = 0; i + 1 < num_segments; ++i)
+        {
+            copies.push_back(pool.submitTask([&segment = std::as_const(segments[i]), destination = output + output_offsets[i]] {
+                const auto fixed_end = std::copy(segment.fixed_symbols.begin(), segment.fixed_symbols.end(), destination);
+                std::copy(segment.symbols.begin() + segment.first_symbol, segment.symbols.end(), fixed_end);
+            }));
+        }
+    }
+    catch (...)
+    {
+        for (auto &copy : copies)
+            copy.wait();
+        throw;
+    }
+    for (auto &copy : copies)
+        copy.wait();
+    for (auto &copy : copies)
+        copy.get();
+}
 
-    return bit_string;
+Decoder::SpeculativeSegment Decoder::decodeSegment(
+    const DecodingTable &decoding_table, const unsigned char *encoded_text, uint64_t encoded_size, uint64_t start_bit, uint64_t end_bit)
+{
+    SpeculativeSegment segment;
+    BitReader reader(encoded_text, encoded_size, start_bit);
+    try
+    {
+        while (reader.position() < end_bit)
+        {
+            if (segment.code_starts.size() < sync_window)
+                segment.code_starts.push_back(reader.position());
+            reader.refill();
+            segment.symbols.push_back(static_cast<char>(decoding_table.decodeSymbol(reader)));
+        }
+    }
+    catch (const std::runtime_error &)
+    {
+        // A wrong guess can run into bits that are not a code. Leave the whole segment to be decoded from its true start.
+        segment.symbols.clear();
+        segment.code_starts.clear();
+    }
+    segment.end_bit = reader.position();
+    return segment;
 }
 
-std::string Decoder::toBitString(std::string::const_iterator start, std::string::const_iterator end)
+void Decoder::synchronize(const DecodingTable &decoding_table, const unsigned char *encoded_text, uint64_t encoded_size,
+    uint64_t start_bit, uint64_t end_bit, SpeculativeSegment &segment)
 {
-    std::string bit_string;
-    while (start != end)
+    BitReader reader(encoded_text, encoded_size, start_bit);
+    auto code_start = segment.code_starts.begin();
+    while (reader.position() < end_bit)
     {
-        const std::bitset<8> bits(*start);
-        bit_string += bits.to_string();
-        ++start;
+        // Once both decodings start a code at the same position, they decode the same codes from there on.
+        const uint64_t position = reader.position();
+        while (code_start != segment.code_starts.end() && *code_start < position)
+            ++code_start;
+        if (code_start != segment.code_starts.end() && *code_start == position)
+        {
+            segment.first_symbol = code_start - segment.code_starts.begin();
+            return;
+        }
+        reader.refill();
+        segment.fixed_symbols.push_back(static_cast<char>(decoding_table.decodeSymbol(reader)));
     }
-    return bit_string;
+
+    // The decodings never met, so every symbol of the segment was decoded from its true start.
+    segment.first_symbol = segment.symbols.size();
+    segment.end_bit = reader.position();
+}
+
+void Decoder::recordLayout(
+    CompressionStats *stats, const Concurrent::ThreadPool &pool, const CompressedLayout &layout, uint64_t compressed_size)
+{
+    if (stats == nullptr)
+        return;
+    stats->bytes_in = compressed_size;
+    stats->bytes_out = layout.decompressed_size;
+    stats->num_frames = layout.frames.size();
+    for (const FrameLayout &frame : layout.frames)
+        stats->num_blocks += frame.frame_header.block_bits.size();
+    stats->num_threads = pool.numberOfWorkers() + 1;
 }
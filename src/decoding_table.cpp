@@ -0,0 +1,101 @@
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include "decoding_table.h"
+
+DecodingTable::DecodingTable(const CodeTable &code_table)
+{
+    std::vector<unsigned char> symbols;
+    uint32_t max_length = 0;
+    for (uint32_t symbol = 0; symbol < code_table.size(); ++symbol)
+    {
+        if (code_table[symbol].length == 0)
+            continue;
+        symbols.push_back(static_cast<unsigned char>(symbol));
+        max_length = std::max<uint32_t>(max_length, code_table[symbol].length);
+    }
+    root_bits = std::clamp<uint32_t>(max_length, 1, max_root_bits);
+    entries.resize(1 << root_bits);
+    fillTable(code_table, symbols, 0, root_bits, 0);
+
+    // A symbol with a code of length n occurs about once every 2^n symbols in the text that the code was built for, which
+    // gives the expected length of a code. Only build the multi symbol table when a lookup is expected to pay off.
+    double expected_length = 0;
+    for (const unsigned char symbol : symbols)
+        expected_length += code_table[symbol].length * std::ldexp(1.0, -code_table[symbol].length);
+    if (!symbols.empty() && 2 * expected_length <= multi_symbol_bits)
+        fillMultiSymbolTable();
+}
+
+unsigned char DecodingTable::decodeLongSymbol(BitReader &reader) const
+{
+    const Entry *entry = &entries[reader.peek(root_bits)];
+    while (entry->sub_table_bits != 0)
+    {
+        reader.consume(entry->length);
+        reader.refill();
+        entry = &entries[entry->value + reader.peek(entry->sub_table_bits)];
+    }
+    if (entry->length == 0)
+        throw std::runtime_error("The encoded text contains a code that does not exist in the decoding table.");
+    reader.consume(entry->length);
+    return static_cast<unsigned char>(entry->value);
+}
+
+void DecodingTable::fillMultiSymbolTable()
+{
+    multi_symbol_entries.resize(1 << multi_symbol_bits);
+    for (uint32_t index = 0; index < multi_symbol_entries.size(); ++index)
+    {
+        MultiSymbolEntry &entry = multi_symbol_entries[index];
+        while (entry.num_symbols < max_symbols_per_entry)
+        {
+            // Look the remaining bits of the index up in the root table, padded with zeros if there are too few of them.
+            // A code that fits in the remaining bits is found no matter what the padding is.
+            const uint32_t remaining = multi_symbol_bits - entry.length;
+            const uint32_t bits = index & ((1 << remaining) - 1);
+            const uint32_t root_index = remaining >= root_bits ? bits >> (remaining - root_bits) : bits << (root_bits - remaining);
+            const Entry &root_entry = entries[root_index];
+            if (root_entry.sub_table_bits != 0 || root_entry.length == 0 || root_entry.length > remaining)
+                break;
+            entry.symbols[entry.num_symbols++] = static_cast<unsigned char>(root_entry.value);
+            entry.length += root_entry.length;
+        }
+    }
+}
+
+void DecodingTable::fillTable(
+    const CodeTable &code_table, const std::vector<unsigned char> &symbols, uint32_t table_start, uint32_t table_bits, uint32_t consumed)
+{
+    // The symbols whose codes do not fit in this table, grouped by the bits that index this table.
+    std::map<uint32_t, std::vector<unsigned char>> long_codes;
+
+    for (const unsigned char symbol : symbols)
+    {
+        const Code &code = code_table[symbol];
+        const uint32_t remaining = code.length - consumed;
+        const uint64_t suffix = remaining == 64 ? code.bits : code.bits & ((uint64_t{1} << remaining) - 1);
+        if (remaining > table_bits)
+        {
+            long_codes[static_cast<uint32_t>(suffix >> (remaining - table_bits))].push_back(symbol);
+            continue;
+        }
+        // Every index that starts with the code decodes to the symbol.
+        const uint32_t first = static_cast<uint32_t>(suffix) << (table_bits - remaining);
+        const uint32_t count = 1 << (table_bits - remaining);
+        for (uint32_t i = first; i < first + count; ++i)
+            entries[table_start + i] = {symbol, static_cast<uint8_t>(remaining), 0};
+    }
+
+    for (const auto &[index, group] : long_codes)
+    {
+        uint32_t max_length = 0;
+        for (const unsigned char symbol : group)
+            max_length = std::max<uint32_t>(max_length, code_table[symbol].length);
+        const uint32_t sub_table_bits = std::min(max_length - consumed - table_bits, max_sub_table_bits);
+        const auto sub_table_start = static_cast<uint32_t>(entries.size());
+        entries.resize(entries.size() + (1 << sub_table_bits));
+        entries[table_start + index] = {sub_table_start, static_cast<uint8_t>(table_bits), static_cast<uint8_t>(sub_table_bits)};
+        fillTable(code_table, group, sub_table_start, sub_table_bits, consumed + table_bits);
+    }
+}
@@ -1,267 +1,803 @@
 #include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <limits>
 #include <memory>
+#include <optional>
 #include <sstream>
-#include <fstream>
 #include <iostream>
-#include <bitset>
+#include <filesystem>
+#include <stdexcept>
+#include <utility>
+#include "bit_writer.h"
+#include "cpu_features.h"
+#include "crc32c.h"
+#include "frame_reader.h"
+#include "frame_writer.h"
+#include "mapped_file.h"
+#include "stage_timer.h"
 #include "encoder.h"
 
-void Encoder::compressFile(const std::string &file_to_compress, const std::string &compressed_file, uint32_t num_threads)
+namespace {
+unsigned char encodeBlock(const CodeTable &code_table, std::string_view block, unsigned char *output, uint64_t bit_offset)
 {
-    // Start up the thread pool for encoding task submission.
-    Concurrent::ThreadPool thread_pool(num_threads);
-
-    // Try to open the file that will be encoded.
-    std::ifstream input_stream;
-    input_stream.exceptions(std::ifstream::failbit);
-    try
+    BitWriter writer(output, bit_offset);
+    const auto *position = reinterpret_cast<const unsigned char *>(block.data());
+    const unsigned char *const end = position + block.size();
+
+    // When no code is longer than 16 bits, four codes are joined and written at once. This makes a quarter as many
+    // writes, and the lookups of the four codes do not wait on each other.
+    uint8_t max_code_length = 0;
+    for (const Code &code : code_table)
+        max_code_length = std::max(max_code_length, code.length);
+    if (max_code_length <= 16)
     {
-        input_stream.open(file_to_compress, std::ios::binary);
+        for (; end - position >= 4; position += 4)
+        {
+            const Code &code0 = code_table[position[0]];
+            const Code &code1 = code_table[position[1]];
+            const Code &code2 = code_table[position[2]];
+            const Code &code3 = code_table[position[3]];
+            const uint64_t bits01 = code0.bits << code1.length | code1.bits;
+            const uint64_t bits23 = code2.bits << code3.length | code3.bits;
+            writer.write(bits01 << (code2.length + code3.length) | bits23, code0.length + code1.length + code2.length + code3.length);
+        }
     }
-    catch (const std::exception &e)
+    for (; position != end; ++position)
     {
-        std::ostringstream msg;
-        msg << "Opening file '" << file_to_compress << "' failed, it either doesn't exist or is not accessible.";
-        throw std::runtime_error(msg.str());
-    }
-
-    // Read the file into memory.
-    std::stringstream buffer;
-    buffer << input_stream.rdbuf();
-    const std::string unencoded_text = buffer.str();
-    input_stream.close();
-
-    // Build the Huffman tree and create the encoding table.
-    std::unordered_map<char, uint64_t> character_frequencies = countCharacterFrequencies(thread_pool, unencoded_text);
-    std::unique_ptr<Node> huffman_tree_root = constructHuffmanTree(character_frequencies);
-    std::unordered_map<char, std::string> huffman_table = constructHuffmanTable(std::move(huffman_tree_root));
-
-    // Encode the text and get the bytes to write to the encoded file.
-    auto [bit_string, block_offsets] = toBitString(thread_pool, huffman_table, unencoded_text);
-    const uint8_t padding = padBitString(bit_string);
-    const std::vector<unsigned char> bytes = toBytes(thread_pool, bit_string);
-
-    std::ofstream output_stream(compressed_file, std::ios::binary);
-
-    // Write the table, offsets, padding, and encoded text to the file.
-    for (const auto &[symbol, code] : huffman_table)
-        output_stream << code << ' ' << std::to_string(static_cast<int>(symbol)) << ' ';
-    output_stream << std::endl << std::to_string(padding) << std::endl;
-    for (const auto &offset : block_offsets)
-        output_stream << std::to_string(offset) << ' ';
-    output_stream << std::endl;
-    std::copy(bytes.begin(), bytes.end(), std::ostreambuf_iterator<char>(output_stream));
-    output_stream.close();
+        const Code &code = code_table[*position];
+        writer.write(code.bits, code.length);
+    }
+    return writer.flush();
 }
 
-std::unordered_map<char, uint64_t> Encoder::countCharacterFrequencies(Concurrent::ThreadPool &pool, const std::string &unencoded_text)
+#ifdef CONCURRENT_HUFFMAN_X86_KERNELS
+// The same kernel, compiled so that the shifts that join codes and fill the writer's word use shlx and shrx.
+CONCURRENT_HUFFMAN_TARGET("bmi2")
+unsigned char encodeBlockWithBmi2(const CodeTable &code_table, std::string_view block, unsigned char *output, uint64_t bit_offset)
 {
-    // The hashmap that will hold the frequency of each character in the file.
-    std::unordered_map<char, uint64_t> character_frequencies;
+    return encodeBlock(code_table, block, output, bit_offset);
+}
+#endif
+} // namespace
 
-    // Blocks of the unencoded text that will be submitted to thread pool for counting.
-    const uint32_t num_blocks = unencoded_text.length() / count_character_block_size;
-    auto block_start = unencoded_text.begin();
+void Encoder::compressFile(Concurrent::ThreadPool &pool, const std::string &file_to_compress, const std::string &compressed_file,
+    const CompressionOptions &options, CompressionStats *stats)
+{
+    validateOptions(options);
+    if (stats != nullptr)
+        *stats = CompressionStats();
+    StageTimer total_timer(stats, &CompressionStats::total);
+
+    // A file larger than a frame is read, encoded, and written one frame at a time. A file that fits in a single frame is
+    // mapped like any other, which gives the same output without starting a thread to read it and another to write it.
+    // This matters for a batch of many small files, whose tasks would otherwise each start two threads.
+    std::error_code error;
+    const uint64_t file_size = std::filesystem::file_size(file_to_compress, error);
+    if (options.memory_limit != 0 && (error || file_size > maxFrameSize(options)))
+    {
+        compressFrames(pool, file_to_compress, compressed_file, options, stats);
+        return;
+    }
 
-    // A vector to hold the futures returned by the thread pool.
-    std::vector<std::future<std::unordered_map<char, uint64_t>>> futures(num_blocks);
+    // Map the file into memory so that every thread can read it in place.
+    StageTimer reading_timer(stats, &CompressionStats::reading);
+    const MappedFile input_file(file_to_compress);
+    const std::string_view unencoded_text(reinterpret_cast<const char *>(input_file.data()), input_file.size());
+    reading_timer.stop();
+    checkWorkerFileSize(pool, input_file.size());
+
+    // Build the code from the character frequencies and encode every block of the text.
+    StageTimer counting_timer(stats, &CompressionStats::counting);
+    const CharacterFrequencies character_frequencies = countCharacterFrequencies(pool, unencoded_text);
+    counting_timer.stop();
+    StageTimer code_construction_timer(stats, &CompressionStats::code_construction);
+    const HeaderData header_data = constructHeaderData(character_frequencies, options);
+    code_construction_timer.stop();
+    StageTimer indexing_timer(stats, &CompressionStats::indexing);
+    const FrameHeader frame_header = constructFrameHeader(pool, header_data, unencoded_text, options);
+    indexing_timer.stop();
+
+    // Lay out the header and the block index, which are small enough to be built in memory.
+    std::ostringstream header_stream;
+    Format::writeHeader(header_stream, header_data);
+    if (!unencoded_text.empty())
+        Format::writeFrameHeader(header_stream, header_data, frame_header);
+    const std::string header = header_stream.str();
+
+    // Create the compressed file at its final size and have the threads encode the blocks in place.
+    StageTimer writing_timer(stats, &CompressionStats::writing);
+    MappedFile output_file(compressed_file, header.size() + encodedSize(frame_header.block_bits));
+    std::copy(header.begin(), header.end(), output_file.data());
+    writing_timer.stop();
+    StageTimer encoding_timer(stats, &CompressionStats::encoding);
+    encode(pool, constructCodeTables(header_data, frame_header), unencoded_text, frame_header, output_file.data() + header.size());
+    encoding_timer.stop();
+
+    if (stats != nullptr)
+    {
+        stats->bytes_in = input_file.size();
+        stats->bytes_out = output_file.size();
+        stats->num_frames = unencoded_text.empty() ? 0 : 1;
+        stats->num_blocks = frame_header.block_bits.size();
+        stats->num_threads = pool.numberOfWorkers() + 1;
+    }
+}
 
-    // Submit blocks to thread pool for counting.
-    for (auto i = 0; i < num_blocks; ++i)
+void Encoder::compress(Concurrent::ThreadPool &pool, std::string_view unencoded_text, std::string &compressed,
+    const CompressionOptions &options, CompressionStats *stats)
+{
+    validateOptions(options);
+    if (stats != nullptr)
+        *stats = CompressionStats();
+    StageTimer total_timer(stats, &CompressionStats::total);
+
+    // Build the code from the character frequencies of the whole text.
+    StageTimer counting_timer(stats, &CompressionStats::counting);
+    const CharacterFrequencies character_frequencies = countCharacterFrequencies(pool, unencoded_text);
+    counting_timer.stop();
+    StageTimer code_construction_timer(stats, &CompressionStats::code_construction);
+    const HeaderData header_data = constructHeaderData(character_frequencies, options);
+    code_construction_timer.stop();
+    std::ostringstream header_stream;
+    Format::writeHeader(header_stream, header_data);
+    const std::string header = header_stream.str();
+    compressed.assign(header.begin(), header.end());
+
+    // Encode the text one frame at a time if there is a memory limit and as a single frame otherwise. The threads encode
+    // the blocks of each frame in place, right after its block index.
+    const uint64_t frame_size = options.memory_limit != 0 ? maxFrameSize(options) : std::max<uint64_t>(unencoded_text.length(), 1);
+    for (uint64_t frame_start = 0; frame_start < unencoded_text.length(); frame_start += frame_size)
     {
-        auto block_end = block_start;
-        std::advance(block_end, count_character_block_size);
-        futures[i] = pool.submitTask([=] { return countCharacterFrequencies(block_start, block_end); });
-        block_start = block_end;
+        const std::string_view frame = unencoded_text.substr(frame_start, frame_size);
+        StageTimer indexing_timer(stats, &CompressionStats::indexing);
+        const FrameHeader frame_header = constructFrameHeader(pool, header_data, frame, options);
+        indexing_timer.stop();
+        std::ostringstream frame_header_stream;
+        Format::writeFrameHeader(frame_header_stream, header_data, frame_header);
+        compressed += frame_header_stream.str();
+        const size_t frame_offset = compressed.size();
+        compressed.resize(frame_offset + encodedSize(frame_header.block_bits));
+        auto *const encoded_frame = reinterpret_cast<unsigned char *>(compressed.data()) + frame_offset;
+        StageTimer encoding_timer(stats, &CompressionStats::encoding);
+        encode(pool, constructCodeTables(header_data, frame_header), frame, frame_header, encoded_frame);
+        encoding_timer.stop();
+        if (stats != nullptr)
+        {
+            ++stats->num_frames;
+            stats->num_blocks += frame_header.block_bits.size();
+        }
     }
-    const auto block_end = unencoded_text.end();
-    character_frequencies = std::move(countCharacterFrequencies(block_start, block_end));
 
-    // Sum up all the counts from the blocks into a single unordered map.
-    for (auto i = 0; i < num_blocks; ++i)
+    if (stats != nullptr)
     {
-        std::unordered_map<char, uint64_t> block_counts = futures[i].get();
-        for (const auto &[character, count] : block_counts)
-            character_frequencies[character] += count;
+        stats->bytes_in = unencoded_text.size();
+        stats->bytes_out = compressed.size();
+        stats->num_threads = pool.numberOfWorkers() + 1;
     }
+}
 
-    return character_frequencies;
+std::vector<CompressionResult> Encoder::compressFiles(
+    Concurrent::ThreadPool &pool, const std::vector<std::pair<std::string, std::string>> &files, const CompressionOptions &options)
+{
+    validateOptions(options);
+
+    // Submit every file that fits in a single block to the thread pool. Such a file is counted, measured, and encoded
+    // without submitting any tasks of its own, so a task that compresses it never waits on the pool. A file whose size
+    // cannot be read is submitted as well, and the task reports why it cannot be compressed.
+    std::vector<CompressionResult> results(files.size());
+    std::vector<std::future<void>> futures;
+    std::vector<size_t> large_files;
+    for (size_t i = 0; i < files.size(); ++i)
+    {
+        std::error_code error;
+        const uint64_t file_size = std::filesystem::file_size(files[i].first, error);
+        if (!error && file_size > encode_block_size)
+        {
+            large_files.push_back(i);
+            continue;
+        }
+        futures.push_back(pool.submitTask([&pool, &file = files[i], &options, &result = results[i]] {
+            result = compressBatchFile(pool, file.first, file.second, options);
+        }));
+    }
+
+    // Compress the larger files one at a time, each of them splits its stages into tasks for every block.
+    for (const size_t i : large_files)
+        results[i] = compressBatchFile(pool, files[i].first, files[i].second, options);
+
+    // Help the pool with the small files that are left rather than waiting idle.
+    for (auto &future : futures)
+    {
+        while (future.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+            pool.runPendingTask();
+        future.get();
+    }
+    return results;
 }
 
-std::unordered_map<char, uint64_t> Encoder::countCharacterFrequencies(std::string::const_iterator start, std::string::const_iterator end)
+void Encoder::validateOptions(const CompressionOptions &options)
 {
-    std::unordered_map<char, uint64_t> character_counts;
-    while (start != end)
+    if (options.max_code_length < 8 || options.max_code_length > CanonicalCode::max_code_length)
+        throw std::invalid_argument("The maximum code length must be between 8 and 64.");
+    if (options.memory_limit != 0 && options.memory_limit < blockMemory(options))
     {
-        ++character_counts[*start];
-        ++start;
+        std::ostringstream msg;
+        msg << "The memory limit must be at least " << blockMemory(options) << " bytes, enough to compress a single block.";
+        throw std::invalid_argument(msg.str());
     }
-    return character_counts;
 }
 
-std::unique_ptr<Node> Encoder::constructHuffmanTree(const std::unordered_map<char, uint64_t> &character_frequencies)
+void Encoder::compressFrames(Concurrent::ThreadPool &pool, const std::string &file_to_compress, const std::string &compressed_file,
+    const CompressionOptions &options, CompressionStats *stats)
 {
-    // A null character is used for nodes that do not have symbols.
-    const char null = '\0';
-
-    // Create a minimum heap that is keyed off character frequency.
-    std::vector<std::unique_ptr<Node>> heap;
-    heap.reserve(character_frequencies.size());
-    for (const auto [character, frequency] : character_frequencies)
-        heap.push_back(std::make_unique<Node>(frequency, character));
-    const auto sort = [](const std::unique_ptr<Node> &left, const std::unique_ptr<Node> &right) -> bool {
-        return left->frequency > right->frequency;
-    };
-    std::make_heap(heap.begin(), heap.end(), sort);
+    const uint64_t frame_size = maxFrameSize(options);
+    StageTimer open_timer(stats, &CompressionStats::reading);
+    std::optional<FrameReader> reader(std::in_place, file_to_compress, frame_size);
+    const uint64_t file_size = std::filesystem::file_size(file_to_compress);
+    open_timer.stop();
+    checkWorkerFileSize(pool, file_size);
+    const uint64_t num_frames = (file_size + frame_size - 1) / frame_size;
+    std::string frame;
+
+    // Count the characters in the file one frame at a time, while the reader reads the frame after the one being counted.
+    CharacterFrequencies character_frequencies{};
+    for (uint64_t i = 0; i < num_frames; ++i)
+    {
+        StageTimer reading_timer(stats, &CompressionStats::reading);
+        if (!reader->next(frame))
+            throw std::runtime_error("The file being compressed was modified during compression.");
+        reading_timer.stop();
+        StageTimer counting_timer(stats, &CompressionStats::counting);
+        addCharacterFrequencies(character_frequencies, countCharacterFrequencies(pool, frame));
+    }
+    reader.reset();
+
+    StageTimer code_construction_timer(stats, &CompressionStats::code_construction);
+    const HeaderData header_data = constructHeaderData(character_frequencies, options);
+    code_construction_timer.stop();
+
+    StageTimer create_timer(stats, &CompressionStats::writing);
+    FrameWriter writer(compressed_file);
+    std::ostringstream header_stream;
+    Format::writeHeader(header_stream, header_data);
+    std::string compressed_frame = header_stream.str();
+    uint64_t compressed_size = compressed_frame.size();
+    writer.write(compressed_frame);
+    create_timer.stop();
+
+    // Encode the file one frame at a time. While a frame is encoded, the reader reads the frame after it and the writer
+    // writes the frame before it. If the file fits in a single frame, the frame that is still in memory is encoded instead
+    // of reading the file a second time.
+    if (num_frames > 1)
+        reader.emplace(file_to_compress, frame_size);
+    for (uint64_t i = 0; i < num_frames; ++i)
+    {
+        StageTimer reading_timer(stats, &CompressionStats::reading);
+        if (reader && !reader->next(frame))
+            throw std::runtime_error("The file being compressed was modified during compression.");
+        reading_timer.stop();
+        StageTimer indexing_timer(stats, &CompressionStats::indexing);
+        const FrameHeader frame_header = constructFrameHeader(pool, header_data, frame, options);
+        indexing_timer.stop();
+        std::ostringstream frame_header_stream;
+        Format::writeFrameHeader(frame_header_stream, header_data, frame_header);
+        // Copy the block index into the buffer, rather than moving it in, so that the memory of the buffer is reused.
+        compressed_frame.assign(frame_header_stream.str());
+        const size_t frame_offset = compressed_frame.size();
+        compressed_frame.resize(frame_offset + encodedSize(frame_header.block_bits));
+        auto *const encoded_frame = reinterpret_cast<unsigned char *>(compressed_frame.data()) + frame_offset;
+        StageTimer encoding_timer(stats, &CompressionStats::encoding);
+        encode(pool, constructCodeTables(header_data, frame_header), frame, frame_header, encoded_frame);
+        encoding_timer.stop();
+        compressed_size += compressed_frame.size();
+        if (stats != nullptr)
+            stats->num_blocks += frame_header.block_bits.size();
+        StageTimer writing_timer(stats, &CompressionStats::writing);
+        writer.write(compressed_frame);
+    }
+    StageTimer writing_timer(stats, &CompressionStats::writing);
+    writer.finish();
+    writing_timer.stop();
+
+    if (stats != nullptr)
+    {
+        stats->bytes_in = file_size;
+        stats->bytes_out = compressed_size;
+        stats->num_frames = num_frames;
+        stats->num_threads = pool.numberOfWorkers() + 1;
+    }
+}
+
+HeaderData Encoder::constructHeaderData(const CharacterFrequencies &character_frequencies, const CompressionOptions &options)
+{
+    HeaderData header_data;
+    header_data.block_size = encode_block_size;
+    header_data.has_checksums = options.checksums;
+    header_data.has_frame_tables = options.blocks_per_table != 0;
+    header_data.has_interleaved_streams = options.interleaved_streams;
+    header_data.code_lengths = constructCodeLengths(character_frequencies, options.max_code_length);
+    return header_data;
+}
 
-    while (heap.size() > 1)
+CodeLengths Encoder::constructCodeLengths(const CharacterFrequencies &character_frequencies, uint8_t max_code_length)
+{
+    // Find the lengths of the codes of the Huffman tree.
+    CodeLengths code_lengths{};
+    if (std::any_of(character_frequencies.begin(), character_frequencies.end(), [](uint64_t count) { return count != 0; }))
+        code_lengths = constructHuffmanCodeLengths(character_frequencies);
+    // Fall back to length-limited codes if the tree is too deep.
+    if (*std::max_element(code_lengths.begin(), code_lengths.end()) > max_code_length)
+        code_lengths = constructLimitedCodeLengths(character_frequencies, max_code_length);
+    return code_lengths;
+}
+
+uint64_t Encoder::maxFrameSize(const CompressionOptions &options)
+{
+    return options.memory_limit / blockMemory(options) * encode_block_size;
+}
+
+uint64_t Encoder::blockMemory(const CompressionOptions &options)
+{
+    // Encoding a frame holds the frame and the encoded frame in memory at the same time, and the frames before and after
+    // it are being written and read meanwhile. In the worst case every character is encoded with the longest code.
+    const uint64_t bits_per_character = 8 + options.max_code_length;
+    uint64_t block_memory = 2 * bits_per_character * encode_block_size / 8;
+    // With frame tables, the characters of every stream of every block stay counted until the tables are chosen.
+    if (options.blocks_per_table != 0)
     {
-        std::unique_ptr<Node> right = std::move(heap.front());
-        std::pop_heap(heap.begin(), heap.end(), sort);
-        heap.pop_back();
-        std::unique_ptr<Node> left = std::move(heap.front());
-        std::pop_heap(heap.begin(), heap.end(), sort);
-        heap.pop_back();
-        heap.push_back(std::make_unique<Node>(left->frequency + right->frequency, null, std::move(left), std::move(right)));
-        std::push_heap(heap.begin(), heap.end(), sort);
+        const uint64_t num_streams = options.interleaved_streams ? Format::interleaved_streams : 1;
+        block_memory += num_streams * sizeof(CharacterFrequencies);
     }
+    return block_memory;
+}
 
-    return std::move(heap.front());
+void Encoder::checkWorkerFileSize(const Concurrent::ThreadPool &pool, uint64_t file_size)
+{
+    // Only compressFiles compresses on a worker, and only files that fit in a single block. A file that has grown since
+    // its size was read would submit tasks and wait for them on one of the workers that has to run them.
+    if (pool.isWorkerThread() && file_size > encode_block_size)
+        throw std::runtime_error("The file being compressed was modified during compression.");
 }
 
-std::unordered_map<char, std::string> Encoder::constructHuffmanTable(std::unique_ptr<Node> huffman_tree_root)
+CompressionResult Encoder::compressBatchFile(Concurrent::ThreadPool &pool, const std::string &file_to_compress,
+    const std::string &compressed_file, const CompressionOptions &options)
 {
-    assert(huffman_tree_root && "Root must not be a null pointer!");
-    std::unordered_map<char, std::string> encoding_table;
-    std::deque<std::pair<Node *, std::string>> node_queue{std::make_pair(huffman_tree_root.get(), "")};
+    CompressionResult result;
+    try
+    {
+        compressFile(pool, file_to_compress, compressed_file, options);
+        result.uncompressed_size = std::filesystem::file_size(file_to_compress);
+        result.compressed_size = std::filesystem::file_size(compressed_file);
+    }
+    catch (...)
+    {
+        result = CompressionResult();
+        result.error = std::current_exception();
+    }
+    return result;
+}
 
-    if (!huffman_tree_root->left && !huffman_tree_root->right)
+CharacterFrequencies Encoder::countCharacterFrequencies(Concurrent::ThreadPool &pool, std::string_view unencoded_text)
+{
+    // Split the text into one contiguous range for each worker and one for this thread, but do not split it into ranges
+    // so small that starting a task costs more than counting them.
+    const uint64_t max_ranges = std::max<uint64_t>(unencoded_text.length() / count_character_block_size, 1);
+    const uint64_t num_ranges = std::min<uint64_t>(pool.numberOfWorkers() + 1, max_ranges);
+    const uint64_t range_size = unencoded_text.length() / num_ranges;
+
+    // Submit every range but the last to the thread pool for counting.
+    std::vector<std::future<CharacterFrequencies>> futures(num_ranges - 1);
+    for (uint64_t i = 0; i + 1 < num_ranges; ++i)
     {
-        encoding_table.insert({huffman_tree_root->symbol, "0"});
-        return encoding_table;
+        const std::string_view range = unencoded_text.substr(i * range_size, range_size);
+        futures[i] = pool.submitTask([range] { return countCharacterFrequencies(range); });
     }
+    CharacterFrequencies character_frequencies = countCharacterFrequencies(unencoded_text.substr((num_ranges - 1) * range_size));
 
-    while (!node_queue.empty())
+    // Sum up the counts from every range.
+    for (auto &future : futures)
+        addCharacterFrequencies(character_frequencies, future.get());
+
+    return character_frequencies;
+}
+
+CharacterFrequencies Encoder::countCharacterFrequencies(std::string_view unencoded_text)
+{
+    // Consecutive characters are counted in separate histograms. A run of the same character would otherwise make every
+    // increment wait for the previous increment of the same count to be stored.
+    std::array<std::array<uint32_t, 256>, 4> counts{};
+    CharacterFrequencies character_frequencies{};
+    const auto *position = reinterpret_cast<const unsigned char *>(unencoded_text.data());
+    const unsigned char *const end = position + unencoded_text.length();
+    while (position != end)
     {
-        auto [node, code] = node_queue.front();
-        node_queue.pop_front();
-        // If the node has no children, then its symbol and code is added to the table.
-        if (!node->left && !node->right)
+        // Count the text in chunks that are small enough that the 32-bit counts can not overflow.
+        const unsigned char *const chunk_end = position + std::min<uint64_t>(end - position, std::numeric_limits<uint32_t>::max());
+        for (; chunk_end - position >= 8; position += 8)
         {
-            encoding_table.insert({node->symbol, code});
-            continue;
+            uint64_t word;
+            std::memcpy(&word, position, sizeof(word));
+            ++counts[0][word & 0xFF];
+            ++counts[1][(word >> 8) & 0xFF];
+            ++counts[2][(word >> 16) & 0xFF];
+            ++counts[3][(word >> 24) & 0xFF];
+            ++counts[0][(word >> 32) & 0xFF];
+            ++counts[1][(word >> 40) & 0xFF];
+            ++counts[2][(word >> 48) & 0xFF];
+            ++counts[3][word >> 56];
         }
-        // A '0' is appended to the code string if it is the left node and a '1' is appended to the code string if is a right node.
-        if (node->left)
-            node_queue.push_front(std::make_pair(node->left.get(), code + '0'));
-        if (node->right)
-            node_queue.push_front(std::make_pair(node->right.get(), code + '1'));
+        for (; position != chunk_end; ++position)
+            ++counts[0][*position];
+
+        for (uint32_t character = 0; character < 256; ++character)
+        {
+            for (const auto &sub_counts : counts)
+                character_frequencies[character] += sub_counts[character];
+        }
+        counts = {};
     }
+    return character_frequencies;
+}
 
-    return encoding_table;
+void Encoder::addCharacterFrequencies(CharacterFrequencies &total, const CharacterFrequencies &counts)
+{
+    for (uint32_t character = 0; character < 256; ++character)
+        total[character] += counts[character];
 }
 
-std::string Encoder::toBitString(
-    const std::unordered_map<char, std::string> &encoding_table, std::string::const_iterator start, std::string::const_iterator end)
+CodeLengths Encoder::constructHuffmanCodeLengths(const CharacterFrequencies &character_frequencies)
 {
-    std::string bit_string;
-    while (start != end)
+    // List the characters that occur in the text in order of increasing frequency.
+    std::array<uint8_t, 256> symbols{};
+    uint32_t num_symbols = 0;
+    for (uint32_t character = 0; character < 256; ++character)
+    {
+        if (character_frequencies[character] != 0)
+            symbols[num_symbols++] = static_cast<uint8_t>(character);
+    }
+    std::sort(symbols.begin(), symbols.begin() + num_symbols, [&character_frequencies](uint8_t left, uint8_t right) {
+        return character_frequencies[left] < character_frequencies[right];
+    });
+
+    CodeLengths code_lengths{};
+    if (num_symbols == 1)
+    {
+        code_lengths[symbols[0]] = 1;
+        return code_lengths;
+    }
+
+    // Find the code lengths in place with the algorithm of Moffat and Katajainen. The array starts out holding the sorted
+    // frequencies and ends up holding the code lengths, without building any nodes.
+    std::array<uint64_t, 256> values{};
+    for (uint32_t i = 0; i < num_symbols; ++i)
+        values[i] = character_frequencies[symbols[i]];
+
+    // Merge the two lightest trees, num_symbols - 1 times. The leaves that are left and the merged trees both come in
+    // order of increasing weight, so the lightest tree is always at the front of one of them. Every merged tree takes the
+    // place of a leaf that has already been merged, and each merged tree is replaced by the index of its parent.
+    uint32_t leaf = 2;
+    uint32_t tree = 0;
+    values[0] += values[1];
+    for (uint32_t next = 1; next + 1 < num_symbols; ++next)
+    {
+        if (leaf >= num_symbols || values[tree] < values[leaf])
+        {
+            values[next] = values[tree];
+            values[tree++] = next;
+        }
+        else
+        {
+            values[next] = values[leaf++];
+        }
+        if (leaf >= num_symbols || (tree < next && values[tree] < values[leaf]))
+        {
+            values[next] += values[tree];
+            values[tree++] = next;
+        }
+        else
+        {
+            values[next] += values[leaf++];
+        }
+    }
+
+    // Replace the parent of every merged tree with its depth, from the root down.
+    values[num_symbols - 2] = 0;
+    for (uint32_t next = num_symbols - 2; next-- > 0;)
+        values[next] = values[values[next]] + 1;
+
+    // Hand out the leaves level by level. Every level has room for twice as many nodes as there are merged trees on the
+    // level above it, and the spots that merged trees do not take hold leaves. The heaviest characters get the first spots.
+    uint64_t available = 1;
+    uint64_t depth = 0;
+    int64_t next_tree = static_cast<int64_t>(num_symbols) - 2;
+    int64_t next_leaf = static_cast<int64_t>(num_symbols) - 1;
+    while (available > 0)
     {
-        bit_string += encoding_table.at(*start);
-        ++start;
+        uint64_t used = 0;
+        for (; next_tree >= 0 && values[next_tree] == depth; --next_tree)
+            ++used;
+        for (; available > used; --available)
+            code_lengths[symbols[next_leaf--]] = static_cast<uint8_t>(depth);
+        available = 2 * used;
+        ++depth;
     }
-    return bit_string;
+    return code_lengths;
 }
 
-std::pair<std::string, std::vector<uint32_t>> Encoder::toBitString(
-    Concurrent::ThreadPool &pool, const std::unordered_map<char, std::string> &encoding_table, const std::string &unencoded_text)
+CodeLengths Encoder::constructLimitedCodeLengths(const CharacterFrequencies &character_frequencies, uint8_t max_code_length)
 {
-    // The entirety of the file encoded as a bit string.
-    std::string bit_string;
+    // The characters sorted by increasing frequency.
+    std::vector<std::pair<uint64_t, unsigned char>> leaves;
+    for (uint32_t character = 0; character < 256; ++character)
+    {
+        if (character_frequencies[character] != 0)
+            leaves.emplace_back(character_frequencies[character], static_cast<unsigned char>(character));
+    }
+    std::sort(leaves.begin(), leaves.end());
+    const size_t num_leaves = leaves.size();
+    assert(num_leaves <= (uint64_t{1} << std::min<uint32_t>(max_code_length, 63)) && "Too many characters for the maximum code length!");
 
-    // Get the blocks of the file that each thread will compressFile.
-    std::vector<uint32_t> block_offsets;
-    const uint32_t block_size = 500;
-    const uint32_t num_blocks = unencoded_text.length() / block_size;
-    auto block_start = unencoded_text.begin();
-    std::vector<std::future<std::string>> futures(num_blocks);
+    CodeLengths code_lengths{};
+    if (num_leaves == 1)
+    {
+        code_lengths[leaves.front().second] = 1;
+        return code_lengths;
+    }
 
-    // Submit blocks to thread pool for encoding.
-    for (auto i = 0; i < num_blocks; ++i)
+    // Build the list of every level, starting from the level of the longest codes. A level holds all the leaves merged
+    // with the packages formed by pairing up consecutive items of the level below it. Only whether each item is a
+    // package needs to be remembered to recover the code lengths.
+    std::vector<std::vector<bool>> is_package(max_code_length);
+    std::vector<uint64_t> previous_weights;
+    for (uint32_t level = max_code_length; level > 0; --level)
     {
-        auto block_end = block_start;
-        std::advance(block_end, block_size);
-        futures[i] = pool.submitTask(
-            [&table = std::as_const(encoding_table), start = block_start, end = block_end] { return toBitString(table, start, end); });
-        block_start = block_end;
+        std::vector<uint64_t> weights;
+        std::vector<bool> &packages = is_package[level - 1];
+        size_t leaf = 0;
+        size_t pair = 0;
+        while (leaf < num_leaves || pair + 1 < previous_weights.size())
+        {
+            const bool take_package = pair + 1 < previous_weights.size() &&
+                                      (leaf == num_leaves || previous_weights[pair] + previous_weights[pair + 1] < leaves[leaf].first);
+            if (take_package)
+            {
+                weights.push_back(previous_weights[pair] + previous_weights[pair + 1]);
+                pair += 2;
+            }
+            else
+            {
+                weights.push_back(leaves[leaf].first);
+                ++leaf;
+            }
+            packages.push_back(take_package);
+        }
+        previous_weights = std::move(weights);
     }
-    const auto block_end = unencoded_text.end();
-    const std::string last_encoded_block = toBitString(encoding_table, block_start, block_end);
 
-    // Combine the text that each thread encoded into a single string.
-    for (auto i = 0; i < num_blocks; ++i)
+    // Select the cheapest 2n - 2 items of the top level. Every leaf selected in a level adds one to the length of its code,
+    // and every selected package selects the two items it was formed from in the level below.
+    size_t num_selected = 2 * num_leaves - 2;
+    for (uint32_t level = 1; level <= max_code_length && num_selected > 0; ++level)
     {
-        const std::string encoded_block = futures[i].get();
-        block_offsets.push_back(encoded_block.length());
-        bit_string += encoded_block;
+        const std::vector<bool> &packages = is_package[level - 1];
+        const auto num_packages = static_cast<size_t>(std::count(packages.begin(), packages.begin() + num_selected, true));
+        for (size_t i = 0; i < num_selected - num_packages; ++i)
+            ++code_lengths[leaves[i].second];
+        num_selected = 2 * num_packages;
     }
-    bit_string += last_encoded_block;
 
-    return std::make_pair(bit_string, block_offsets);
+    return code_lengths;
 }
 
-uint8_t Encoder::padBitString(std::string &bit_string)
+FrameHeader Encoder::constructFrameHeader(
+    Concurrent::ThreadPool &pool, const HeaderData &header_data, std::string_view unencoded_text, const CompressionOptions &options)
 {
-    // Add the minimum number of zeros to the bit string such that it has a size divisible by 8.
-    const uint8_t padding = 8 * ((bit_string.length() / 8) + 1) - bit_string.length();
-    const std::string padding_zeros(padding, '0');
-    bit_string += padding_zeros;
-    return padding;
+    const uint64_t num_blocks = Format::numberOfBlocks(unencoded_text.length(), encode_block_size);
+    FrameHeader frame_header;
+    frame_header.uncompressed_size = unencoded_text.length();
+    frame_header.block_bits.resize(num_blocks);
+    if (header_data.has_checksums)
+        frame_header.block_checksums.resize(num_blocks);
+    if (num_blocks == 0)
+        return frame_header;
+
+    // Count the characters of every stream of a block, and checksum the block, while it is in the cache of a single thread.
+    // Without frame tables every block uses the code of the file, so only the length of each stream is kept. With them,
+    // the counts are kept until the table of every block has been chosen.
+    const uint32_t num_streams = Format::numberOfStreams(header_data);
+    std::vector<CharacterFrequencies> stream_frequencies(header_data.has_frame_tables ? num_blocks * num_streams : 0);
+    std::vector<uint64_t> stream_bits(num_blocks * num_streams);
+    const auto measure = [&stream_frequencies, &stream_bits, &frame_header, &header_data, num_streams](uint64_t i, std::string_view block) {
+        const uint64_t stream_size = Format::streamSize(block.length(), num_streams);
+        for (uint32_t stream = 0; stream < num_streams; ++stream)
+        {
+            const std::string_view stream_text = block.substr(std::min<uint64_t>(stream * stream_size, block.length()), stream_size);
+            const CharacterFrequencies character_frequencies = countCharacterFrequencies(stream_text);
+            if (header_data.has_frame_tables)
+                stream_frequencies[i * num_streams + stream] = character_frequencies;
+            else
+                stream_bits[i * num_streams + stream] = encodedBits(header_data.code_lengths, character_frequencies);
+        }
+        if (header_data.has_checksums)
+            frame_header.block_checksums[i] = Crc32c::compute(reinterpret_cast<const unsigned char *>(block.data()), block.length());
+    };
+
+    // Submit every block but the last to the thread pool for measuring.
+    std::vector<std::future<void>> futures(num_blocks - 1);
+    for (uint64_t i = 0; i + 1 < num_blocks; ++i)
+    {
+        const std::string_view block = unencoded_text.substr(i * encode_block_size, encode_block_size);
+        futures[i] = pool.submitTask([&measure, i, block] { measure(i, block); });
+    }
+    measure(num_blocks - 1, unencoded_text.substr((num_blocks - 1) * encode_block_size));
+    for (auto &future : futures)
+        future.get();
+
+    // The length of a stream is the number of times each character occurs times the length of its code in the table that
+    // its block was given.
+    if (header_data.has_frame_tables)
+    {
+        constructFrameTables(pool, header_data.code_lengths, stream_frequencies, num_streams, options, frame_header);
+        for (uint64_t i = 0; i < num_blocks; ++i)
+        {
+            const uint32_t table = Format::blockTable(frame_header, i);
+            const CodeLengths &code_lengths = table == 0 ? header_data.code_lengths : frame_header.code_tables[table - 1];
+            for (uint32_t stream = 0; stream < num_streams; ++stream)
+                stream_bits[i * num_streams + stream] = encodedBits(code_lengths, stream_frequencies[i * num_streams + stream]);
+        }
+    }
+
+    // A block is as long as its streams together.
+    if (num_streams > 1)
+        frame_header.stream_bits.reserve(num_blocks * (num_streams - 1));
+    for (uint64_t i = 0; i < num_blocks; ++i)
+    {
+        uint64_t num_bits = 0;
+        for (uint32_t stream = 0; stream < num_streams; ++stream)
+        {
+            const uint64_t bits = stream_bits[i * num_streams + stream];
+            if (stream + 1 < num_streams)
+                frame_header.stream_bits.push_back(static_cast<uint32_t>(bits));
+            num_bits += bits;
+        }
+        frame_header.block_bits[i] = static_cast<uint32_t>(num_bits);
+    }
+    return frame_header;
 }
 
-std::vector<unsigned char> Encoder::toBytes(Concurrent::ThreadPool &pool, const std::string &bit_string)
+void Encoder::constructFrameTables(Concurrent::ThreadPool &pool, const CodeLengths &code_lengths,
+    const std::vector<CharacterFrequencies> &stream_frequencies, uint32_t num_streams, const CompressionOptions &options,
+    FrameHeader &frame_header)
 {
-    // Holds the entirety of the bytes produced by the bit string.
-    std::vector<unsigned char> bytes;
+    // Add up the character counts of every group and build the code that fits each group best, one task per group.
+    const uint64_t num_blocks = stream_frequencies.size() / num_streams;
+    const uint64_t num_groups = (num_blocks + options.blocks_per_table - 1) / options.blocks_per_table;
+    std::vector<CharacterFrequencies> group_frequencies(num_groups);
+    std::vector<CodeLengths> group_code_lengths(num_groups);
+    const auto construct = [&](uint64_t group) {
+        const uint64_t group_end = std::min<uint64_t>((group + 1) * options.blocks_per_table, num_blocks);
+        CharacterFrequencies &character_frequencies = group_frequencies[group];
+        character_frequencies = {};
+        for (uint64_t i = group * options.blocks_per_table * num_streams; i < group_end * num_streams; ++i)
+            addCharacterFrequencies(character_frequencies, stream_frequencies[i]);
+        group_code_lengths[group] = constructCodeLengths(character_frequencies, options.max_code_length);
+    };
+    std::vector<std::future<void>> futures(num_groups - 1);
+    for (uint64_t group = 0; group + 1 < num_groups; ++group)
+        futures[group] = pool.submitTask([&construct, group] { construct(group); });
+    construct(num_groups - 1);
+    for (auto &future : futures)
+        future.get();
+
+    // Walk through the groups in order. A group keeps using the table of the group before it, or the table of the file if
+    // that table is missing some of its characters, unless its own table saves enough bits to pay for storing it.
+    frame_header.block_tables.resize(num_blocks);
+    uint32_t previous_table = 0;
+    for (uint64_t group = 0; group < num_groups; ++group)
+    {
+        const CharacterFrequencies &character_frequencies = group_frequencies[group];
+        uint32_t table = previous_table;
+        if (table != 0 && !canEncode(frame_header.code_tables[table - 1], character_frequencies))
+            table = 0;
+        const uint64_t reused_bits = encodedBits(table == 0 ? code_lengths : frame_header.code_tables[table - 1], character_frequencies);
+        const uint64_t own_bits =
+            encodedBits(group_code_lengths[group], character_frequencies) + 8 * Format::codeLengthsSize(group_code_lengths[group]);
+        if (own_bits < reused_bits && (reused_bits - own_bits) * 100 >= reused_bits * min_table_gain_percent)
+        {
+            frame_header.code_tables.push_back(group_code_lengths[group]);
+            table = static_cast<uint32_t>(frame_header.code_tables.size());
+        }
+        const uint64_t group_start = group * options.blocks_per_table;
+        const uint64_t group_end = std::min<uint64_t>(group_start + options.blocks_per_table, num_blocks);
+        std::fill(frame_header.block_tables.begin() + group_start, frame_header.block_tables.begin() + group_end, table);
+        previous_table = table;
+    }
+}
 
-    // Break the bit string into blocks (of a size that is divisible by 8) that will be converted to bytes.
-    const uint32_t num_blocks = bit_string.length() / to_bytes_block_size;
-    auto block_start = bit_string.begin();
-    std::vector<std::future<std::vector<unsigned char>>> futures(num_blocks);
+uint64_t Encoder::encodedBits(const CodeLengths &code_lengths, const CharacterFrequencies &character_frequencies)
+{
+    uint64_t num_bits = 0;
+    for (uint32_t character = 0; character < 256; ++character)
+        num_bits += character_frequencies[character] * code_lengths[character];
+    return num_bits;
+}
 
-    // Submit blocks to thread pool for conversion to bytes.
-    for (auto i = 0; i < num_blocks; ++i)
+bool Encoder::canEncode(const CodeLengths &code_lengths, const CharacterFrequencies &character_frequencies)
+{
+    for (uint32_t character = 0; character < 256; ++character)
     {
-        auto block_end = block_start;
-        std::advance(block_end, to_bytes_block_size);
-        futures[i] = pool.submitTask([start = block_start, end = block_end] { return toBytes(start, end); });
-        block_start = block_end;
+        if (character_frequencies[character] != 0 && code_lengths[character] == 0)
+            return false;
     }
-    const auto block_end = bit_string.end();
-    const std::vector<unsigned char> last_block = toBytes(block_start, block_end);
+    return true;
+}
+
+std::vector<CodeTable> Encoder::constructCodeTables(const HeaderData &header_data, const FrameHeader &frame_header)
+{
+    std::vector<CodeTable> code_tables{CanonicalCode::fromLengths(header_data.code_lengths)};
+    for (const CodeLengths &code_lengths : frame_header.code_tables)
+        code_tables.push_back(CanonicalCode::fromLengths(code_lengths));
+    return code_tables;
+}
 
-    // Combine the bytes from each block into a single vector.
-    for (auto i = 0; i < num_blocks; ++i)
+void Encoder::encode(Concurrent::ThreadPool &pool, const std::vector<CodeTable> &code_tables, std::string_view unencoded_text,
+    const FrameHeader &frame_header, unsigned char *output)
+{
+    const std::vector<uint32_t> &block_bits = frame_header.block_bits;
+    if (block_bits.empty())
+        return;
+
+    // Find where each block starts in the output, the blocks are written back to back without any padding.
+    std::vector<uint64_t> bit_offsets(block_bits.size() + 1);
+    for (size_t i = 0; i < block_bits.size(); ++i)
+        bit_offsets[i + 1] = bit_offsets[i] + block_bits[i];
+
+    // Every byte is stored by the block that its last bit belongs to, except for a final byte that is only partly filled.
+    // Clear that byte, since the blocks only merge their bits into it.
+    if (bit_offsets.back() % 8 != 0)
+        output[bit_offsets.back() / 8] = 0;
+
+    // Submit every block but the last to the thread pool for encoding.
+    const size_t num_blocks = block_bits.size();
+    std::vector<std::future<unsigned char>> futures(num_blocks - 1);
+    for (size_t i = 0; i + 1 < num_blocks; ++i)
+    {
+        const std::string_view block = unencoded_text.substr(i * encode_block_size, encode_block_size);
+        const CodeTable &code_table = code_tables[Format::blockTable(frame_header, i)];
+        futures[i] = pool.submitTask(
+            [&code_table, block, output, bit_offset = bit_offsets[i]] { return encode(code_table, block, output, bit_offset); });
+    }
+    const unsigned char last_final_byte = encode(code_tables[Format::blockTable(frame_header, num_blocks - 1)],
+        unencoded_text.substr((num_blocks - 1) * encode_block_size), output, bit_offsets[num_blocks - 1]);
+
+    // A block that ends part way through a byte shares that byte with the blocks after it. Merge in the bits of the
+    // shared bytes once every block has been written, since the block after may still be storing the byte until then.
+    std::vector<unsigned char> final_bytes;
+    final_bytes.reserve(num_blocks);
+    for (auto &future : futures)
+        final_bytes.push_back(future.get());
+    final_bytes.push_back(last_final_byte);
+    for (size_t i = 0; i < num_blocks; ++i)
     {
-        const std::vector<unsigned char> block_bytes = futures[i].get();
-        bytes.insert(bytes.end(), block_bytes.begin(), block_bytes.end());
+        if (bit_offsets[i + 1] % 8 != 0)
+            output[bit_offsets[i + 1] / 8] |= final_bytes[i];
     }
-    bytes.insert(bytes.end(), last_block.begin(), last_block.end());
+}
 
-    return bytes;
+unsigned char Encoder::encode(const CodeTable &code_table, std::string_view block, unsigned char *output, uint64_t bit_offset)
+{
+#ifdef CONCURRENT_HUFFMAN_X86_KERNELS
+    if (CpuFeatures::hasBmi2())
+        return encodeBlockWithBmi2(code_table, block, output, bit_offset);
+#endif
+    return encodeBlock(code_table, block, output, bit_offset);
 }
 
-std::vector<unsigned char> Encoder::toBytes(std::string::const_iterator start, std::string::const_iterator end)
+uint64_t Encoder::encodedSize(const std::vector<uint32_t> &block_bits)
 {
-    std::vector<unsigned char> bytes;
-    bytes.reserve(std::distance(start, end) / 8);
-    while (start != end)
-    {
-        const std::string bit_string(start, start + 8);
-        const std::bitset<8> bits{bit_string};
-        const unsigned char byte = (bits.to_ulong() & 0xFF);
-        bytes.push_back(byte);
-        std::advance(start, 8);
-    }
-    return bytes;
-}
\ No newline at end of file
+    uint64_t num_bits = 0;
+    for (const uint32_t bits : block_bits)
+        num_bits += bits;
+    return (num_bits + 7) / 8;
+}
@@ -0,0 +1,187 @@
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+#include "format.h"
+
+namespace {
+template<typename T>
+void writeInteger(std::ostream &output, T value)
+{
+    char bytes[sizeof(T)];
+    for (size_t i = 0; i < sizeof(T); ++i)
+        bytes[i] = static_cast<char>(static_cast<uint64_t>(value) >> (8 * i));
+    output.write(bytes, sizeof(T));
+}
+
+template<typename T>
+T readInteger(std::istream &input)
+{
+    unsigned char bytes[sizeof(T)];
+    if (!input.read(reinterpret_cast<char *>(bytes), sizeof(T)))
+        throw std::runtime_error("The compressed file is truncated.");
+    uint64_t value = 0;
+    for (size_t i = 0; i < sizeof(T); ++i)
+        value |= static_cast<uint64_t>(bytes[i]) << (8 * i);
+    return static_cast<T>(value);
+}
+
+void writeCodeLengths(std::ostream &output, const CodeLengths &code_lengths)
+{
+    const auto num_symbols =
+        static_cast<uint16_t>(std::count_if(code_lengths.begin(), code_lengths.end(), [](uint8_t length) { return length != 0; }));
+    writeInteger<uint16_t>(output, num_symbols);
+    if (num_symbols < 128)
+    {
+        for (uint32_t symbol = 0; symbol < code_lengths.size(); ++symbol)
+        {
+            if (code_lengths[symbol] == 0)
+                continue;
+            writeInteger<uint8_t>(output, symbol);
+            writeInteger<uint8_t>(output, code_lengths[symbol]);
+        }
+    }
+    else
+    {
+        for (const uint8_t length : code_lengths)
+            writeInteger<uint8_t>(output, length);
+    }
+}
+
+CodeLengths readCodeLengths(std::istream &input)
+{
+    CodeLengths code_lengths{};
+    const auto num_symbols = readInteger<uint16_t>(input);
+    if (num_symbols > 256)
+        throw std::runtime_error("The compressed file has an invalid code table.");
+    if (num_symbols < 128)
+    {
+        for (uint32_t i = 0; i < num_symbols; ++i)
+        {
+            const auto symbol = readInteger<uint8_t>(input);
+            code_lengths[symbol] = readInteger<uint8_t>(input);
+        }
+    }
+    else
+    {
+        for (uint8_t &length : code_lengths)
+            length = readInteger<uint8_t>(input);
+    }
+    if (!CanonicalCode::isValid(code_lengths))
+        throw std::runtime_error("The compressed file has an invalid code table.");
+    return code_lengths;
+}
+} // namespace
+
+void Format::writeHeader(std::ostream &output, const HeaderData &header_data)
+{
+    uint8_t flags = 0;
+    if (header_data.has_checksums)
+        flags |= checksum_flag;
+    if (header_data.has_frame_tables)
+        flags |= frame_tables_flag;
+    if (header_data.has_interleaved_streams)
+        flags |= interleaved_streams_flag;
+
+    output.write(magic, sizeof(magic));
+    writeInteger<uint8_t>(output, version);
+    writeInteger<uint8_t>(output, flags);
+    writeCodeLengths(output, header_data.code_lengths);
+    writeInteger<uint32_t>(output, header_data.block_size);
+}
+
+HeaderData Format::readHeader(std::istream &input)
+{
+    HeaderData header_data;
+
+    char file_magic[sizeof(magic)];
+    if (!input.read(file_magic, sizeof(file_magic)) || !std::equal(std::begin(magic), std::end(magic), file_magic))
+        throw std::runtime_error("The file was not compressed with this tool.");
+    if (readInteger<uint8_t>(input) != version)
+        throw std::runtime_error("The compressed file uses an unsupported version of the format.");
+    const auto flags = readInteger<uint8_t>(input);
+    if ((flags & ~known_flags) != 0)
+        throw std::runtime_error("The compressed file uses unsupported features of the format.");
+    header_data.has_checksums = (flags & checksum_flag) != 0;
+    header_data.has_frame_tables = (flags & frame_tables_flag) != 0;
+    header_data.has_interleaved_streams = (flags & interleaved_streams_flag) != 0;
+    header_data.code_lengths = readCodeLengths(input);
+
+    header_data.block_size = readInteger<uint32_t>(input);
+    if (header_data.block_size == 0)
+        throw std::runtime_error("The compressed file has an invalid block size.");
+
+    return header_data;
+}
+
+void Format::writeFrameHeader(std::ostream &output, const HeaderData &header_data, const FrameHeader &frame_header)
+{
+    writeInteger<uint64_t>(output, frame_header.uncompressed_size);
+    for (const uint32_t bits : frame_header.block_bits)
+        writeInteger<uint32_t>(output, bits);
+    for (const uint32_t checksum : frame_header.block_checksums)
+        writeInteger<uint32_t>(output, checksum);
+    for (const uint32_t bits : frame_header.stream_bits)
+        writeInteger<uint32_t>(output, bits);
+    if (!header_data.has_frame_tables)
+        return;
+    writeInteger<uint32_t>(output, static_cast<uint32_t>(frame_header.code_tables.size()));
+    for (const CodeLengths &code_lengths : frame_header.code_tables)
+        writeCodeLengths(output, code_lengths);
+    for (uint64_t i = 0; i < frame_header.block_bits.size(); ++i)
+        writeInteger<uint32_t>(output, blockTable(frame_header, i));
+}
+
+FrameHeader Format::readFrameHeader(std::istream &input, const HeaderData &header_data)
+{
+    FrameHeader frame_header;
+    frame_header.uncompressed_size = readInteger<uint64_t>(input);
+    // A size this close to the largest integer would wrap around when it is rounded up to a whole number of blocks.
+    if (frame_header.uncompressed_size > std::numeric_limits<uint64_t>::max() - (header_data.block_size - 1))
+        throw std::runtime_error("The compressed file is corrupt.");
+    const uint64_t num_blocks = numberOfBlocks(frame_header.uncompressed_size, header_data.block_size);
+    for (uint64_t i = 0; i < num_blocks; ++i)
+        frame_header.block_bits.push_back(readInteger<uint32_t>(input));
+    if (header_data.has_checksums)
+    {
+        for (uint64_t i = 0; i < num_blocks; ++i)
+            frame_header.block_checksums.push_back(readInteger<uint32_t>(input));
+    }
+    if (header_data.has_interleaved_streams)
+    {
+        for (uint64_t i = 0; i < num_blocks; ++i)
+        {
+            // The streams are stored back to back within the block, so the streams before the last cannot be longer than it.
+            uint64_t num_bits = 0;
+            for (uint32_t stream = 0; stream + 1 < interleaved_streams; ++stream)
+            {
+                frame_header.stream_bits.push_back(readInteger<uint32_t>(input));
+                num_bits += frame_header.stream_bits.back();
+            }
+            if (num_bits > frame_header.block_bits[i])
+                throw std::runtime_error("The compressed file is corrupt.");
+        }
+    }
+    if (header_data.has_frame_tables)
+    {
+        const auto num_tables = readInteger<uint32_t>(input);
+        if (num_tables > num_blocks)
+            throw std::runtime_error("The compressed file has an invalid code table.");
+        for (uint32_t i = 0; i < num_tables; ++i)
+            frame_header.code_tables.push_back(readCodeLengths(input));
+        for (uint64_t i = 0; i < num_blocks; ++i)
+        {
+            frame_header.block_tables.push_back(readInteger<uint32_t>(input));
+            if (frame_header.block_tables.back() > num_tables)
+                throw std::runtime_error("The compressed file has an invalid code table.");
+        }
+    }
+    return frame_header;
+}
+
+uint64_t Format::codeLengthsSize(const CodeLengths &code_lengths)
+{
+    const auto num_symbols = static_cast<uint64_t>(std::count_if(code_lengths.begin(), code_lengths.end(), [](uint8_t length) {
+        return length != 0;
+    }));
+    return sizeof(uint16_t) + (num_symbols < 128 ? 2 * num_symbols : code_lengths.size());
+}
@@ -0,0 +1,88 @@
+#include <cerrno>
+#include <sstream>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+#include "frame_reader.h"
+
+FrameReader::FrameReader(const std::string &file_name_, uint64_t frame_size_)
+    : file_name(file_name_)
+    , frame_size(frame_size_)
+{
+    descriptor = ::open(file_name.c_str(), O_RDONLY);
+    if (descriptor == -1)
+    {
+        std::ostringstream msg;
+        msg << "Opening file '" << file_name << "' failed, it either doesn't exist or is not accessible.";
+        throw std::runtime_error(msg.str());
+    }
+#ifdef POSIX_FADV_SEQUENTIAL
+    // The file is read from start to end, so the kernel can read further ahead than it would otherwise.
+    ::posix_fadvise(descriptor, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+    free_frames.push(std::string());
+    thread = std::thread(&FrameReader::readFrames, this);
+}
+
+FrameReader::~FrameReader()
+{
+    free_frames.close();
+    read_frames.close();
+    thread.join();
+    ::close(descriptor);
+}
+
+bool FrameReader::next(std::string &frame)
+{
+    free_frames.push(std::move(frame));
+    frame.clear();
+    if (read_frames.pop(frame))
+        return true;
+    if (error)
+        std::rethrow_exception(error);
+    return false;
+}
+
+void FrameReader::readFrames()
+{
+    try
+    {
+        std::string frame;
+        while (free_frames.pop(frame))
+        {
+            readFrame(frame);
+            if (frame.empty() || !read_frames.push(std::move(frame)))
+                break;
+        }
+    }
+    catch (...)
+    {
+        error = std::current_exception();
+    }
+    // Closing the queue publishes the error, if there is one, to the thread that is waiting for the next frame.
+    read_frames.close();
+}
+
+void FrameReader::readFrame(std::string &frame)
+{
+    frame.resize(frame_size);
+    uint64_t num_bytes = 0;
+    while (num_bytes < frame_size)
+    {
+        const ssize_t result =
+            ::pread(descriptor, frame.data() + num_bytes, frame_size - num_bytes, static_cast<off_t>(offset + num_bytes));
+        if (result == 0)
+            break;
+        if (result == -1)
+        {
+            if (errno == EINTR)
+                continue;
+            std::ostringstream msg;
+            msg << "Reading file '" << file_name << "' failed.";
+            throw std::runtime_error(msg.str());
+        }
+        num_bytes += static_cast<uint64_t>(result);
+    }
+    frame.resize(num_bytes);
+    offset += num_bytes;
+}
@@ -0,0 +1,95 @@
+#include <cerrno>
+#include <sstream>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+#include "frame_writer.h"
+
+FrameWriter::FrameWriter(const std::string &file_name_)
+    : file_name(file_name_)
+{
+    descriptor = ::open(file_name.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (descriptor == -1)
+    {
+        std::ostringstream msg;
+        msg << "Creating file '" << file_name << "' failed, it is either not accessible or there is not enough space.";
+        throw std::runtime_error(msg.str());
+    }
+    free_frames.push(std::string());
+    thread = std::thread(&FrameWriter::writeFrames, this);
+}
+
+FrameWriter::~FrameWriter()
+{
+    free_frames.close();
+    written_frames.close();
+    if (thread.joinable())
+        thread.join();
+    if (descriptor != -1)
+        ::close(descriptor);
+}
+
+void FrameWriter::write(std::string &frame)
+{
+    // Take the buffer of the piece before this one back first, which waits for that piece to be written.
+    std::string buffer;
+    if (!free_frames.pop(buffer) || !written_frames.push(std::move(frame)))
+        std::rethrow_exception(error);
+    frame = std::move(buffer);
+    frame.clear();
+}
+
+void FrameWriter::finish()
+{
+    written_frames.close();
+    thread.join();
+    if (error)
+        std::rethrow_exception(error);
+    const int result = ::close(descriptor);
+    descriptor = -1;
+    if (result == -1)
+    {
+        std::ostringstream msg;
+        msg << "Writing file '" << file_name << "' failed, there may not be enough space.";
+        throw std::runtime_error(msg.str());
+    }
+}
+
+void FrameWriter::writeFrames()
+{
+    try
+    {
+        std::string frame;
+        while (written_frames.pop(frame))
+        {
+            writeFrame(frame);
+            frame.clear();
+            free_frames.push(std::move(frame));
+        }
+    }
+    catch (...)
+    {
+        // Closing the queues publishes the error to the thread that hands in the pieces and stops it from waiting.
+        error = std::current_exception();
+        free_frames.close();
+        written_frames.close();
+    }
+}
+
+void FrameWriter::writeFrame(const std::string &frame)
+{
+    uint64_t num_bytes = 0;
+    while (num_bytes < frame.size())
+    {
+        const ssize_t result = ::write(descriptor, frame.data() + num_bytes, frame.size() - num_bytes);
+        if (result == -1)
+        {
+            if (errno == EINTR)
+                continue;
+            std::ostringstream msg;
+            msg << "Writing file '" << file_name << "' failed, there may not be enough space.";
+            throw std::runtime_error(msg.str());
+        }
+        num_bytes += static_cast<uint64_t>(result);
+    }
+}
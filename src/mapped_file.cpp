@@ -0,0 +1,62 @@
+#include <sstream>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "mapped_file.h"
+
+MappedFile::MappedFile(const std::string &file_name)
+{
+    descriptor = ::open(file_name.c_str(), O_RDONLY);
+    struct stat file_status{};
+    if (descriptor == -1 || ::fstat(descriptor, &file_status) == -1)
+    {
+        if (descriptor != -1)
+            ::close(descriptor);
+        std::ostringstream msg;
+        msg << "Opening file '" << file_name << "' failed, it either doesn't exist or is not accessible.";
+        throw std::runtime_error(msg.str());
+    }
+    length = file_status.st_size;
+    map(file_name, false);
+}
+
+MappedFile::MappedFile(const std::string &file_name, uint64_t size_)
+    : length(size_)
+{
+    descriptor = ::open(file_name.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (descriptor == -1 || ::ftruncate(descriptor, static_cast<off_t>(length)) == -1)
+    {
+        if (descriptor != -1)
+            ::close(descriptor);
+        std::ostringstream msg;
+        msg << "Creating file '" << file_name << "' failed, it is either not accessible or there is not enough space.";
+        throw std::runtime_error(msg.str());
+    }
+    map(file_name, true);
+}
+
+MappedFile::~MappedFile()
+{
+    if (address != nullptr)
+        ::munmap(address, length);
+    ::close(descriptor);
+}
+
+void MappedFile::map(const std::string &file_name, bool writable)
+{
+    // Empty files cannot be mapped, they are represented by a null address instead.
+    if (length == 0)
+        return;
+    const int protection = writable ? PROT_READ | PROT_WRITE : PROT_READ;
+    void *mapping = ::mmap(nullptr, length, protection, MAP_SHARED, descriptor, 0);
+    if (mapping == MAP_FAILED)
+    {
+        ::close(descriptor);
+        std::ostringstream msg;
+        msg << "Mapping file '" << file_name << "' into memory failed.";
+        throw std::runtime_error(msg.str());
+    }
+    address = static_cast<unsigned char *>(mapping);
+}
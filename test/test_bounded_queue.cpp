@@ -0,0 +1,26 @@
+#include <gtest/gtest.h>
+#include <thread>
+#include <vector>
+#include "bounded_queue.h"
+
+// Tests that items come out in the order they went in, that a full queue holds back the producer, and that closing the
+// queue lets the consumer take what is left.
+TEST(BoundedQueue, PushAndPopTest)
+{
+    Concurrent::BoundedQueue<int> queue(2);
+    std::vector<int> popped;
+    std::thread consumer([&] {
+        int item;
+        while (queue.pop(item))
+            popped.push_back(item);
+    });
+    for (int i = 0; i < 10000; ++i)
+        ASSERT_TRUE(queue.push(i));
+    queue.close();
+    consumer.join();
+
+    ASSERT_EQ(popped.size(), 10000);
+    for (int i = 0; i < 10000; ++i)
+        ASSERT_EQ(popped[i], i);
+    ASSERT_FALSE(queue.push(0));
+}
@@ -3,6 +3,48 @@
 #include <sstream>
 #include <filesystem>
 #include "concurrent_huffman.h"
+#include "cpu_features.h"
+#include "encoder.h"
+#include "format.h"
+
+namespace {
+// Compresses text in memory into a new string.
+std::string compressText(std::string_view text, const CompressionOptions &options = CompressionOptions(),
+    Concurrent::ThreadPool &pool = ConcurrentHuffman::defaultPool())
+{
+    std::string compressed;
+    ConcurrentHuffman::compress(text, compressed, pool, options);
+    return compressed;
+}
+
+// Decompresses text in memory into a new string.
+std::string decompressText(std::string_view compressed, Concurrent::ThreadPool &pool = ConcurrentHuffman::defaultPool())
+{
+    std::string decompressed;
+    ConcurrentHuffman::decompress(compressed, decompressed, pool);
+    return decompressed;
+}
+} // namespace
+
+// Reaches the construction of the code lengths, which is private to the encoder.
+class EncoderTest
+{
+public:
+    static CodeLengths constructHuffmanCodeLengths(const CharacterFrequencies &character_frequencies)
+    {
+        return Encoder::constructHuffmanCodeLengths(character_frequencies);
+    }
+
+    static CodeLengths constructLimitedCodeLengths(const CharacterFrequencies &character_frequencies, uint8_t max_code_length)
+    {
+        return Encoder::constructLimitedCodeLengths(character_frequencies, max_code_length);
+    }
+
+    static uint64_t encodedBits(const CodeLengths &code_lengths, const CharacterFrequencies &character_frequencies)
+    {
+        return Encoder::encodedBits(code_lengths, character_frequencies);
+    }
+};
 
 // Tests encoding / decoding a file that only consists of a single, repeated, alphabetical character.
 TEST(Huffman, EncodingAndDecodingTest1)
@@ -142,4 +184,547 @@ TEST(Huffman, EncodingAndDecodingTest5)
     // Clean up the files created during the tests.
     std::filesystem::remove("test5_encoded.txt");
     std::filesystem::remove("test5_decoded.txt");
-}
\ No newline at end of file
+}
+
+// Tests encoding / decoding a file that is empty.
+TEST(Huffman, EncodingAndDecodingTest6)
+{
+    // Read the file to compressFile into memory.
+    std::string file_to_encode = "test6_input.txt";
+    std::ifstream file1(file_to_encode);
+    std::stringstream buffer1;
+    buffer1 << file1.rdbuf();
+    std::string expected_decoded_text = buffer1.str();
+
+    std::string encoded_file = "test6_encoded.txt";
+    std::string decoded_file = "test6_decoded.txt";
+    ConcurrentHuffman::compressFile(file_to_encode, encoded_file);
+    ConcurrentHuffman::decompressFile(encoded_file, decoded_file);
+
+    // Read the decoded file into memory.
+    std::ifstream file2(decoded_file);
+    std::stringstream buffer2;
+    buffer2 << file2.rdbuf();
+    std::string actual_decoded_text = buffer2.str();
+
+    ASSERT_EQ(expected_decoded_text, actual_decoded_text);
+
+    // Clean up the files created during the tests.
+    std::filesystem::remove("test6_encoded.txt");
+    std::filesystem::remove("test6_decoded.txt");
+}
+
+// Tests that decoding a file that was not compressed with this tool fails.
+TEST(Huffman, DecodingUncompressedFileTest)
+{
+    ASSERT_THROW(ConcurrentHuffman::decompressFile("test3_input.txt", "test3_decoded.txt"), std::runtime_error);
+
+    // Clean up the files created during the tests.
+    std::filesystem::remove("test3_decoded.txt");
+}
+
+// Tests that decompressing text whose frames claim impossible sizes fails instead of writing past the decompressed text.
+TEST(Huffman, DecodingCorruptFrameSizeTest)
+{
+    const std::string compressed = compressText(std::string(100000, 'a') + std::string(100000, 'b'));
+    std::istringstream input(compressed);
+    const HeaderData header_data = Format::readHeader(input);
+    const auto frame_start = static_cast<size_t>(input.tellg());
+    const auto frameSize = [](uint64_t uncompressed_size) {
+        std::string bytes(sizeof(uint64_t), '\0');
+        for (size_t i = 0; i < bytes.size(); ++i)
+            bytes[i] = static_cast<char>(uncompressed_size >> (8 * i));
+        return bytes;
+    };
+
+    // An empty frame whose size rounds up to zero blocks, so the decompressed size of the frame after it wraps around.
+    const uint64_t wrapping_size = UINT64_MAX - header_data.block_size + 2;
+    const std::string wrapping = compressed.substr(0, frame_start) + frameSize(wrapping_size) + compressed.substr(frame_start);
+    ASSERT_THROW(decompressText(wrapping), std::runtime_error);
+
+    // A frame that holds more characters than it has bits.
+    std::string oversized = compressed;
+    oversized.replace(frame_start, sizeof(uint64_t), frameSize(uint64_t(1) << 40));
+    ASSERT_THROW(decompressText(oversized), std::runtime_error);
+
+    // A frame whose encoded text runs past the end of the compressed text.
+    ASSERT_THROW(decompressText(compressed.substr(0, compressed.size() - 1)), std::runtime_error);
+}
+
+// Tests encoding / decoding a file with a code length limit that is shorter than its longest Huffman code.
+TEST(Huffman, EncodingAndDecodingLimitedCodeLengthTest)
+{
+    // Read the file to compressFile into memory.
+    std::string file_to_encode = "test4_input.txt";
+    std::ifstream file1(file_to_encode);
+    std::stringstream buffer1;
+    buffer1 << file1.rdbuf();
+    std::string expected_decoded_text = buffer1.str();
+
+    std::string encoded_file = "test4_limited_encoded.txt";
+    std::string decoded_file = "test4_limited_decoded.txt";
+    CompressionOptions options;
+    options.max_code_length = 8;
+    ConcurrentHuffman::compressFile(file_to_encode, encoded_file, ConcurrentHuffman::defaultPool(), options);
+    ConcurrentHuffman::decompressFile(encoded_file, decoded_file);
+
+    // Read the decoded file into memory.
+    std::ifstream file2(decoded_file);
+    std::stringstream buffer2;
+    buffer2 << file2.rdbuf();
+    std::string actual_decoded_text = buffer2.str();
+
+    ASSERT_EQ(expected_decoded_text, actual_decoded_text);
+
+    // Clean up the files created during the tests.
+    std::filesystem::remove("test4_limited_encoded.txt");
+    std::filesystem::remove("test4_limited_decoded.txt");
+}
+
+// Tests that the Huffman code lengths found in place cost as many bits as the optimal code lengths found by package-merge
+// with the longest codes allowed, for degenerate counts as well as ordinary ones.
+TEST(Huffman, HuffmanCodeLengthsTest)
+{
+    std::vector<CharacterFrequencies> cases;
+    CharacterFrequencies frequencies{};
+
+    // A single character, and two characters of very different frequency.
+    frequencies['x'] = 1000;
+    cases.push_back(frequencies);
+    frequencies['y'] = 1;
+    cases.push_back(frequencies);
+
+    // Every character with the same frequency.
+    frequencies.fill(7);
+    cases.push_back(frequencies);
+
+    // Fibonacci frequencies, which give the deepest tree for the number of characters.
+    frequencies = {};
+    uint64_t previous = 1;
+    uint64_t current = 1;
+    for (uint32_t character = 0; character < 50; ++character)
+    {
+        frequencies[character * 5] = current;
+        const uint64_t next = previous + current;
+        previous = current;
+        current = next;
+    }
+    cases.push_back(frequencies);
+
+    // The counts of a text file.
+    std::ifstream file("test4_input.txt", std::ios::binary);
+    std::stringstream buffer;
+    buffer << file.rdbuf();
+    frequencies = {};
+    for (const char character : buffer.str())
+        ++frequencies[static_cast<unsigned char>(character)];
+    cases.push_back(frequencies);
+
+    for (const CharacterFrequencies &character_frequencies : cases)
+    {
+        const CodeLengths code_lengths = EncoderTest::constructHuffmanCodeLengths(character_frequencies);
+        const CodeLengths optimal_code_lengths =
+            EncoderTest::constructLimitedCodeLengths(character_frequencies, CanonicalCode::max_code_length);
+        ASSERT_TRUE(CanonicalCode::isValid(code_lengths));
+        ASSERT_EQ(EncoderTest::encodedBits(optimal_code_lengths, character_frequencies),
+            EncoderTest::encodedBits(code_lengths, character_frequencies));
+        for (uint32_t character = 0; character < 256; ++character)
+            ASSERT_EQ(character_frequencies[character] != 0, code_lengths[character] != 0);
+    }
+}
+
+// Tests encoding / decoding a file with a memory limit that splits the file into many frames.
+TEST(Huffman, EncodingAndDecodingMemoryLimitTest)
+{
+    // Write a file of five and a half blocks.
+    std::string file_to_encode = "memory_limit_input.txt";
+    std::string expected_decoded_text;
+    for (uint32_t i = 0; i < 360000; ++i)
+        expected_decoded_text += static_cast<char>('a' + (i * i + i / 1000) % 26);
+    std::ofstream(file_to_encode, std::ios::binary) << expected_decoded_text;
+
+    // A limit of 3 MiB leaves room for two blocks with the longest codes, so the file is split into three frames.
+    std::string encoded_file = "memory_limit_encoded.txt";
+    std::string decoded_file = "memory_limit_decoded.txt";
+    CompressionOptions options;
+    options.memory_limit = 3 << 20;
+    CompressionStats stats;
+    ConcurrentHuffman::compressFile(file_to_encode, encoded_file, ConcurrentHuffman::defaultPool(), options, &stats);
+    ASSERT_EQ(3, stats.num_frames);
+    ConcurrentHuffman::decompressFile(encoded_file, decoded_file, ConcurrentHuffman::defaultPool(), &stats);
+    ASSERT_EQ(3, stats.num_frames);
+
+    // Read the decoded file into memory.
+    std::ifstream file2(decoded_file);
+    std::stringstream buffer2;
+    buffer2 << file2.rdbuf();
+    std::string actual_decoded_text = buffer2.str();
+
+    ASSERT_EQ(expected_decoded_text, actual_decoded_text);
+
+    // Clean up the files created during the tests.
+    std::filesystem::remove("memory_limit_input.txt");
+    std::filesystem::remove("memory_limit_encoded.txt");
+    std::filesystem::remove("memory_limit_decoded.txt");
+}
+
+// Tests that a memory limit too small to compress a single block is rejected.
+TEST(Huffman, MemoryLimitTooSmallTest)
+{
+    CompressionOptions options;
+    options.memory_limit = 10000;
+    ASSERT_THROW(compressText("some text", options), std::invalid_argument);
+}
+
+// Tests that compressing text in memory produces the same bytes as compressing a file, and that it decompresses.
+TEST(Huffman, InMemoryEncodingAndDecodingTest)
+{
+    // Read the file to compress into memory.
+    std::string file_to_encode = "test4_input.txt";
+    std::ifstream file1(file_to_encode, std::ios::binary);
+    std::stringstream buffer1;
+    buffer1 << file1.rdbuf();
+    std::string expected_decoded_text = buffer1.str();
+
+    std::string encoded_file = "test4_in_memory_encoded.txt";
+    ConcurrentHuffman::compressFile(file_to_encode, encoded_file);
+    std::ifstream file2(encoded_file, std::ios::binary);
+    std::stringstream buffer2;
+    buffer2 << file2.rdbuf();
+    std::string expected_encoded_text = buffer2.str();
+
+    const std::string encoded_text = compressText(expected_decoded_text);
+    ASSERT_EQ(expected_encoded_text, encoded_text);
+    ASSERT_EQ(expected_decoded_text, decompressText(encoded_text));
+
+    // Clean up the files created during the tests.
+    std::filesystem::remove("test4_in_memory_encoded.txt");
+}
+
+// Tests compressing and decompressing text in memory into buffers that are reused between calls.
+TEST(Huffman, InMemoryEncodingAndDecodingReusedBufferTest)
+{
+    CompressionOptions options;
+    options.memory_limit = 3 << 20;
+    std::string encoded_text;
+    std::string decoded_text;
+    for (const std::string &text : {std::string(300000, 'a') + "bcd", std::string(), std::string("a short string")})
+    {
+        ConcurrentHuffman::compress(text, encoded_text, ConcurrentHuffman::defaultPool(), options);
+        ConcurrentHuffman::decompress(encoded_text, decoded_text, ConcurrentHuffman::defaultPool());
+        ASSERT_EQ(text, decoded_text);
+    }
+}
+
+// Tests decoding with more threads than blocks, which splits every block between the threads at guessed positions.
+TEST(Huffman, DecodingWithMoreThreadsThanBlocksTest)
+{
+    // Read the file to compress into memory.
+    std::ifstream file1("test4_input.txt", std::ios::binary);
+    std::stringstream buffer1;
+    buffer1 << file1.rdbuf();
+    std::string expected_decoded_text;
+    for (uint32_t i = 0; i < 20; ++i)
+        expected_decoded_text += buffer1.str();
+
+    const std::string encoded_text = compressText(expected_decoded_text);
+    Concurrent::ThreadPool pool(16);
+    ASSERT_EQ(expected_decoded_text, decompressText(encoded_text, pool));
+}
+
+// Tests decompressing ranges of a file that is split into many frames, including ranges that cross frames.
+TEST(Huffman, DecodingRangeTest)
+{
+    // Write a file of five and a half blocks.
+    std::string file_to_encode = "range_input.txt";
+    std::string decoded_text;
+    for (uint32_t i = 0; i < 360000; ++i)
+        decoded_text += static_cast<char>('a' + (i * i + i / 1000) % 26);
+    std::ofstream(file_to_encode, std::ios::binary) << decoded_text;
+
+    // A limit of 3 MiB splits the file into three frames, the first two of which hold two blocks of 64 KiB each.
+    std::string encoded_file = "range_encoded.txt";
+    CompressionOptions options;
+    options.memory_limit = 3 << 20;
+    CompressionStats stats;
+    ConcurrentHuffman::compressFile(file_to_encode, encoded_file, ConcurrentHuffman::defaultPool(), options, &stats);
+    ASSERT_EQ(3, stats.num_frames);
+    const uint64_t frame_size = 2 << 16;
+    Concurrent::ThreadPool &pool = ConcurrentHuffman::defaultPool();
+
+    ASSERT_EQ(decoded_text, ConcurrentHuffman::decompressRange(encoded_file, 0, decoded_text.length(), pool));
+    ASSERT_EQ(decoded_text.substr(1000, 5000), ConcurrentHuffman::decompressRange(encoded_file, 1000, 5000, pool));
+    ASSERT_EQ(decoded_text.substr(7000, 1), ConcurrentHuffman::decompressRange(encoded_file, 7000, 1, pool));
+
+    // Ranges that end at, start at and straddle the boundary between each pair of frames.
+    for (uint64_t boundary = frame_size; boundary < decoded_text.length(); boundary += frame_size)
+    {
+        ASSERT_EQ(decoded_text.substr(boundary - 100, 100), ConcurrentHuffman::decompressRange(encoded_file, boundary - 100, 100, pool));
+        ASSERT_EQ(decoded_text.substr(boundary, 100), ConcurrentHuffman::decompressRange(encoded_file, boundary, 100, pool));
+        ASSERT_EQ(decoded_text.substr(boundary - 1, 2), ConcurrentHuffman::decompressRange(encoded_file, boundary - 1, 2, pool));
+        ASSERT_EQ(decoded_text.substr(boundary - 70000, 140000),
+            ConcurrentHuffman::decompressRange(encoded_file, boundary - 70000, 140000, pool));
+    }
+
+    // A range that starts in the first frame and ends in the last one.
+    ASSERT_EQ(decoded_text.substr(frame_size - 10, frame_size + 20),
+        ConcurrentHuffman::decompressRange(encoded_file, frame_size - 10, frame_size + 20, pool));
+    ASSERT_EQ("", ConcurrentHuffman::decompressRange(encoded_file, decoded_text.length(), 0, pool));
+    ASSERT_THROW(ConcurrentHuffman::decompressRange(encoded_file, decoded_text.length(), 1, pool), std::out_of_range);
+
+    // Clean up the files created during the tests.
+    std::filesystem::remove("range_input.txt");
+    std::filesystem::remove("range_encoded.txt");
+}
+
+// Tests that a file compressed with checksums decompresses and verifies, and that a damaged block is detected.
+TEST(Huffman, ChecksumTest)
+{
+    // Read the file to compress into memory.
+    std::string file_to_encode = "test4_input.txt";
+    std::ifstream file1(file_to_encode, std::ios::binary);
+    std::stringstream buffer1;
+    buffer1 << file1.rdbuf();
+    std::string expected_decoded_text = buffer1.str();
+
+    std::string encoded_file = "test4_checksum_encoded.txt";
+    CompressionOptions options;
+    options.checksums = true;
+    ConcurrentHuffman::compressFile(file_to_encode, encoded_file, ConcurrentHuffman::defaultPool(), options);
+    ASSERT_NO_THROW(ConcurrentHuffman::verifyFile(encoded_file, ConcurrentHuffman::defaultPool()));
+
+    std::ifstream file2(encoded_file, std::ios::binary);
+    std::stringstream buffer2;
+    buffer2 << file2.rdbuf();
+    std::string encoded_text = buffer2.str();
+    ASSERT_EQ(expected_decoded_text, decompressText(encoded_text));
+
+    // Swap two bytes in the middle of the encoded text, which keeps the number of encoded bits the same.
+    std::swap(encoded_text[encoded_text.length() / 2], encoded_text[encoded_text.length() / 2 + 100]);
+    std::ofstream(encoded_file, std::ios::binary) << encoded_text;
+    ASSERT_THROW(ConcurrentHuffman::verifyFile(encoded_file, ConcurrentHuffman::defaultPool()), std::runtime_error);
+    ASSERT_THROW(decompressText(encoded_text), std::runtime_error);
+
+    // Clean up the files created during the tests.
+    std::filesystem::remove("test4_checksum_encoded.txt");
+}
+
+// Tests that one thread pool can be reused by many calls, including calls made from several threads at once.
+TEST(Huffman, SharedThreadPoolTest)
+{
+    Concurrent::ThreadPool pool(3);
+    std::vector<std::thread> threads;
+    for (uint32_t i = 0; i < 4; ++i)
+    {
+        threads.emplace_back([&pool, i] {
+            for (uint32_t j = 0; j < 50; ++j)
+            {
+                const std::string text = std::string(j * 1000, 'a' + i) + "bcd";
+                ASSERT_EQ(text, decompressText(compressText(text, CompressionOptions(), pool), pool));
+            }
+        });
+    }
+    for (auto &thread : threads)
+        thread.join();
+
+    const std::string text = "the default pool is shared by the whole process";
+    ASSERT_EQ(text, decompressText(compressText(text)));
+}
+
+// Tests that a call made from a task that is running on the same pool is rejected rather than left to deadlock.
+TEST(Huffman, CallFromTaskOfSamePoolTest)
+{
+    Concurrent::ThreadPool pool(2);
+    Concurrent::ThreadPool other_pool(1);
+    ASSERT_THROW(pool.submitTask([&pool] { compressText("some text", CompressionOptions(), pool); }).get(), std::logic_error);
+    // A task of another pool may still use the pool.
+    auto round_trip =
+        other_pool.submitTask([&pool] { return decompressText(compressText("some text", CompressionOptions(), pool), pool); });
+    ASSERT_EQ("some text", round_trip.get());
+}
+
+// Tests compressing a batch of small and large files, one of which does not exist.
+TEST(Huffman, BatchEncodingTest)
+{
+    std::vector<std::pair<std::string, std::string>> files;
+    for (uint32_t i = 0; i < 20; ++i)
+    {
+        const std::string name = "batch_input_" + std::to_string(i) + ".txt";
+        std::ofstream(name) << std::string(i * i * 500, 'a' + i % 3) << "bcd";
+        files.emplace_back(name, name + ".huff");
+    }
+    files.emplace_back("batch_input_missing.txt", "batch_input_missing.txt.huff");
+
+    Concurrent::ThreadPool pool(4);
+    const std::vector<CompressionResult> results = ConcurrentHuffman::compressFiles(files, pool);
+    ASSERT_EQ(files.size(), results.size());
+    for (uint32_t i = 0; i < 20; ++i)
+    {
+        ASSERT_FALSE(results[i].error);
+        ASSERT_EQ(std::filesystem::file_size(files[i].first), results[i].uncompressed_size);
+        ASSERT_EQ(std::filesystem::file_size(files[i].second), results[i].compressed_size);
+        ConcurrentHuffman::decompressFile(files[i].second, "batch_output.txt");
+        std::ifstream expected(files[i].first);
+        std::ifstream actual("batch_output.txt");
+        std::stringstream expected_text;
+        std::stringstream actual_text;
+        expected_text << expected.rdbuf();
+        actual_text << actual.rdbuf();
+        ASSERT_EQ(expected_text.str(), actual_text.str());
+        std::filesystem::remove(files[i].first);
+        std::filesystem::remove(files[i].second);
+    }
+    std::filesystem::remove("batch_output.txt");
+    ASSERT_TRUE(results.back().error);
+    ASSERT_THROW(std::rethrow_exception(results.back().error), std::runtime_error);
+}
+
+// Tests encoding / decoding text whose sections use different characters with a code table for each group of blocks.
+TEST(Huffman, FrameTablesTest)
+{
+    std::string text;
+    for (uint32_t section = 0; section < 12; ++section)
+    {
+        const std::string alphabet = section % 2 == 0 ? "0123456789,." : "abcdefghijklmnopqrstuvwxyz ";
+        for (uint32_t i = 0; i < 100000; ++i)
+            text += alphabet[(i * i + section) % alphabet.length()];
+    }
+
+    CompressionOptions options;
+    options.blocks_per_table = 1;
+    options.memory_limit = 3 << 20;
+    options.checksums = true;
+    const std::string encoded_text = compressText(text, options);
+    ASSERT_LT(encoded_text.size(), compressText(text).size());
+    ASSERT_EQ(text, decompressText(encoded_text));
+
+    std::ofstream("frame_tables_test.huff", std::ios::binary) << encoded_text;
+    Concurrent::ThreadPool &pool = ConcurrentHuffman::defaultPool();
+    ConcurrentHuffman::verifyFile("frame_tables_test.huff", pool);
+    ASSERT_EQ(text.substr(250000, 300000), ConcurrentHuffman::decompressRange("frame_tables_test.huff", 250000, 300000, pool));
+    std::filesystem::remove("frame_tables_test.huff");
+}
+
+// Tests decoding text with mostly short codes, which are decoded several at a time, and a few codes that are too long to be.
+TEST(Huffman, EncodingAndDecodingShortAndLongCodesTest)
+{
+    std::string text;
+    for (uint32_t i = 0; i < 500000; ++i)
+    {
+        uint32_t symbol = 0;
+        while (symbol < 40 && (i * 2654435761u >> symbol) % 4 == 0)
+            ++symbol;
+        text += static_cast<char>(i % 7 == 0 ? 'a' + symbol : 'a' + i % 3);
+    }
+    ASSERT_EQ(text, decompressText(compressText(text)));
+}
+
+// Tests that blocks split into interleaved streams decode to the same text, including blocks too short to fill every stream.
+TEST(Huffman, InterleavedStreamsTest)
+{
+    std::string text;
+    for (uint32_t i = 0; i < 700000; ++i)
+        text += static_cast<char>(i % 11 == 0 ? '0' + i % 10 : 'a' + (i * i) % 26);
+
+    CompressionOptions options;
+    options.interleaved_streams = true;
+    options.blocks_per_table = 2;
+    options.checksums = true;
+    const std::string encoded_text = compressText(text, options);
+    ASSERT_EQ(text, decompressText(encoded_text));
+    ASSERT_EQ("abc", decompressText(compressText("abc", options)));
+
+    std::ofstream("interleaved_streams_test.huff", std::ios::binary) << encoded_text;
+    Concurrent::ThreadPool &pool = ConcurrentHuffman::defaultPool();
+    ConcurrentHuffman::verifyFile("interleaved_streams_test.huff", pool);
+    ASSERT_EQ(text.substr(100000, 300000), ConcurrentHuffman::decompressRange("interleaved_streams_test.huff", 100000, 300000, pool));
+    std::filesystem::remove("interleaved_streams_test.huff");
+}
+
+// Tests that the portable kernels and the kernels that use instruction set extensions write and read the same files.
+TEST(Huffman, PortableKernelsTest)
+{
+    std::string text;
+    for (uint32_t i = 0; i < 300000; ++i)
+        text += static_cast<char>(i % 13 == 0 ? 'A' + i % 26 : 'a' + (i * i) % 7);
+
+    CompressionOptions options;
+    options.checksums = true;
+    options.interleaved_streams = true;
+    CpuFeatures::setExtensionsEnabled(false);
+    const std::string portable_encoded_text = compressText(text, options);
+    CpuFeatures::setExtensionsEnabled(true);
+    const std::string encoded_text = compressText(text, options);
+    ASSERT_EQ(portable_encoded_text, encoded_text);
+    ASSERT_EQ(text, decompressText(encoded_text));
+    CpuFeatures::setExtensionsEnabled(false);
+    ASSERT_EQ(text, decompressText(encoded_text));
+    CpuFeatures::setExtensionsEnabled(true);
+}
+
+// Tests that compressing a file with a memory limit, which reads, encodes, and writes frames side by side, produces the
+// same bytes as compressing the file in memory one frame at a time.
+TEST(Huffman, PipelinedFileEncodingTest)
+{
+    std::string text;
+    for (uint32_t i = 0; i < 2000000; ++i)
+        text += static_cast<char>('a' + (i * i + i / 1000) % 19);
+    std::ofstream("pipelined_input.txt", std::ios::binary) << text;
+
+    CompressionOptions options;
+    options.memory_limit = 3 << 20;
+    options.checksums = true;
+    ConcurrentHuffman::compressFile("pipelined_input.txt", "pipelined_encoded.huff", ConcurrentHuffman::defaultPool(), options);
+    std::ifstream encoded_file("pipelined_encoded.huff", std::ios::binary);
+    std::stringstream encoded_text;
+    encoded_text << encoded_file.rdbuf();
+    ASSERT_EQ(compressText(text, options), encoded_text.str());
+    ASSERT_EQ(text, decompressText(encoded_text.str()));
+
+    // A file that fits in a single frame is compressed without the reader and the writer, to the same bytes.
+    const std::string short_text = text.substr(0, 100000);
+    std::ofstream("pipelined_input.txt", std::ios::binary | std::ios::trunc) << short_text;
+    ConcurrentHuffman::compressFile("pipelined_input.txt", "pipelined_encoded.huff", ConcurrentHuffman::defaultPool(), options);
+    std::ifstream short_encoded_file("pipelined_encoded.huff", std::ios::binary);
+    std::stringstream short_encoded_text;
+    short_encoded_text << short_encoded_file.rdbuf();
+    ASSERT_EQ(compressText(short_text, options), short_encoded_text.str());
+
+    std::filesystem::remove("pipelined_input.txt");
+    std::filesystem::remove("pipelined_encoded.huff");
+}
+
+// Tests that the statistics of compressing and decompressing in memory count the bytes, frames, blocks and threads of
+// the call and time its stages.
+TEST(Huffman, CompressionStatsTest)
+{
+    std::string text;
+    for (uint32_t i = 0; i < 1000000; ++i)
+        text += static_cast<char>('a' + (i * 7 + i / 100) % 23);
+
+    CompressionOptions options;
+    options.memory_limit = 3 << 20;
+    Concurrent::ThreadPool pool(2);
+    CompressionStats stats;
+    std::string compressed;
+    ConcurrentHuffman::compress(text, compressed, pool, options, &stats);
+    ASSERT_EQ(stats.bytes_in, text.size());
+    ASSERT_EQ(stats.bytes_out, compressed.size());
+    ASSERT_GT(stats.num_frames, 1);
+    ASSERT_GE(stats.num_blocks, stats.num_frames);
+    ASSERT_EQ(stats.num_threads, 3);
+    ASSERT_GT(stats.encoding.wall_time.count(), 0);
+    ASSERT_GE(stats.total.wall_time, stats.counting.wall_time + stats.indexing.wall_time + stats.encoding.wall_time);
+
+    const CompressionStats compression_stats = stats;
+    std::string decompressed;
+    ConcurrentHuffman::decompress(compressed, decompressed, pool, &stats);
+    ASSERT_EQ(text, decompressed);
+    ASSERT_EQ(stats.bytes_in, compressed.size());
+    ASSERT_EQ(stats.bytes_out, text.size());
+    ASSERT_EQ(stats.num_frames, compression_stats.num_frames);
+    ASSERT_EQ(stats.num_blocks, compression_stats.num_blocks);
+    ASSERT_GT(stats.decoding.wall_time.count(), 0);
+    ASSERT_EQ(stats.encoding.wall_time.count(), 0);
+    ASSERT_LE(stats.utilization(), 1.0);
+}
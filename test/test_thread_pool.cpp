@@ -0,0 +1,75 @@
+#include <gtest/gtest.h>
+#include <chrono>
+#include <numeric>
+#include <vector>
+#include "thread_pool.h"
+
+// Tests that every submitted task runs and returns its result.
+TEST(ThreadPool, SubmitTaskTest)
+{
+    Concurrent::ThreadPool pool(4);
+    std::vector<std::future<uint64_t>> futures;
+    for (uint64_t i = 0; i < 10000; ++i)
+        futures.push_back(pool.submitTask([i] { return i * i; }));
+
+    for (uint64_t i = 0; i < futures.size(); ++i)
+        ASSERT_EQ(i * i, futures[i].get());
+}
+
+// Tests that tasks can submit tasks of their own and wait for them, even when the pool has a single worker.
+TEST(ThreadPool, NestedSubmitTaskTest)
+{
+    Concurrent::ThreadPool pool(1);
+    auto outer = pool.submitTask([&pool] {
+        std::vector<std::future<uint64_t>> futures;
+        for (uint64_t i = 1; i <= 100; ++i)
+            futures.push_back(pool.submitTask([i] { return i; }));
+        uint64_t sum = 0;
+        for (auto &future : futures)
+        {
+            while (future.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+                pool.runPendingTask();
+            sum += future.get();
+        }
+        return sum;
+    });
+
+    ASSERT_EQ(5050, outer.get());
+}
+
+// Tests that only the workers of a pool count as its worker threads.
+TEST(ThreadPool, IsWorkerThreadTest)
+{
+    Concurrent::ThreadPool pool(2);
+    Concurrent::ThreadPool other_pool(1);
+    ASSERT_FALSE(pool.isWorkerThread());
+    ASSERT_TRUE(pool.submitTask([&pool] { return pool.isWorkerThread(); }).get());
+    ASSERT_FALSE(other_pool.submitTask([&pool] { return pool.isWorkerThread(); }).get());
+}
+
+// Tests that the counters of the pool account for every task that was submitted and run.
+TEST(ThreadPool, StatsTest)
+{
+    Concurrent::ThreadPool pool(2);
+    std::vector<std::future<void>> futures;
+    for (uint32_t i = 0; i < 1000; ++i)
+        futures.push_back(pool.submitTask([] {}));
+    for (auto &future : futures)
+        future.wait();
+
+    const Concurrent::ThreadPoolStats stats = pool.stats();
+    ASSERT_EQ(2, stats.workers.size());
+    ASSERT_EQ(1000, stats.tasks_submitted);
+    ASSERT_EQ(0, stats.queue_depth);
+    ASSERT_GE(stats.max_queue_depth, 1);
+    uint64_t tasks_executed = stats.callers.tasks_executed;
+    for (const Concurrent::WorkerStats &worker : stats.workers)
+    {
+        ASSERT_LE(worker.tasks_stolen, worker.tasks_executed);
+        tasks_executed += worker.tasks_executed;
+    }
+    ASSERT_EQ(1000, tasks_executed);
+    ASSERT_EQ(1000, std::accumulate(stats.wait_histogram.begin(), stats.wait_histogram.end(), uint64_t(0)));
+    ASSERT_GT(stats.waitTimePercentile(0.99).count(), 0);
+    ASSERT_LE(stats.utilization(), 1.0);
+}